@@ -0,0 +1,119 @@
+/*
+ *   File:   checkpoint.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Write checkpoint file
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+
+#include "project.h"
+#include "checkpoint.h"
+
+// The checkpoint is a single fixed size record, rewritten in place after
+// every acknowledged chunk. It is flushed to the OS but not synced, which
+// keeps the per-chunk cost to one small write while still surviving the
+// process being killed or the programmer being unplugged.
+
+static FILE *_checkpoint_file;
+static char *_checkpoint_filename;
+static checkpoint_t _checkpoint;
+
+static void checkpoint_flush(void)
+{
+    if (!_checkpoint_file)
+        return;
+
+    fseek(_checkpoint_file, 0, SEEK_SET);
+    fwrite(&_checkpoint, sizeof(_checkpoint), 1, _checkpoint_file);
+    fflush(_checkpoint_file);
+}
+
+bool checkpoint_load(const char *filename, checkpoint_t *checkpoint)
+{
+    FILE *file;
+    size_t file_read;
+
+#ifdef _WIN32
+    if (fopen_s(&file, filename, "rb"))
+#else
+    if (!(file = fopen(filename, "rb")))
+#endif /* _WIN32 */
+        return false;
+
+    file_read = fread(checkpoint, sizeof(checkpoint_t), 1, file);
+    fclose(file);
+
+    if (file_read != 1 || checkpoint->magic != CHECKPOINT_MAGIC)
+        return false;
+
+    return true;
+}
+
+bool checkpoint_begin(const char *filename, const checkpoint_t *checkpoint)
+{
+#ifdef _WIN32
+    if (fopen_s(&_checkpoint_file, filename, "wb"))
+#else
+    if (!(_checkpoint_file = fopen(filename, "wb")))
+#endif /* _WIN32 */
+    {
+        _checkpoint_file = NULL;
+        return false;
+    }
+
+    _checkpoint_filename = _strdup(filename);
+    _checkpoint = *checkpoint;
+    _checkpoint.magic = CHECKPOINT_MAGIC;
+
+    checkpoint_flush();
+
+    return true;
+}
+
+void checkpoint_chunk_written(int offset)
+{
+    _checkpoint.chunk_offset = offset;
+    checkpoint_flush();
+}
+
+void checkpoint_pass_complete(int pass)
+{
+    _checkpoint.passes_completed = pass + 1;
+    _checkpoint.chunk_offset = 0;
+    checkpoint_flush();
+}
+
+void checkpoint_verified(int pass)
+{
+    _checkpoint.verified_pass = pass;
+    checkpoint_flush();
+}
+
+void checkpoint_end(bool completed)
+{
+    if (!_checkpoint_file)
+        return;
+
+    fclose(_checkpoint_file);
+    _checkpoint_file = NULL;
+
+    if (completed)
+        remove(_checkpoint_filename);
+
+    free(_checkpoint_filename);
+    _checkpoint_filename = NULL;
+}
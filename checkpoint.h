@@ -0,0 +1,45 @@
+/*
+ *   File:   checkpoint.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Write checkpoint file
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#define CHECKPOINT_MAGIC        0x4B435648 /* 'HVCK' */
+#define CHECKPOINT_EXTENSION    ".ckpt"
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t image_crc;
+    int32_t dev_type;
+    int32_t num_passes;
+    int32_t passes_completed;
+    int32_t chunk_offset;
+    int32_t verified_pass;
+} checkpoint_t;
+
+bool checkpoint_load(const char *filename, checkpoint_t *checkpoint);
+bool checkpoint_begin(const char *filename, const checkpoint_t *checkpoint);
+void checkpoint_chunk_written(int offset);
+void checkpoint_pass_complete(int pass);
+void checkpoint_verified(int pass);
+void checkpoint_end(bool completed);
+
+#endif /* __CHECKPOINT_H__ */
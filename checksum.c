@@ -0,0 +1,518 @@
+/*
+ *   File:   checksum.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Checksum routines
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+
+#include "project.h"
+#include "checksum.h"
+
+#define CRC32_POLY      0xEDB88320
+#define CRC16_POLY      0x1021
+
+#define LOAD_U32_LE(p)  ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) | ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+#define LOAD_U32_BE(p)  (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+#define ROTL32(x, n)    (((x) << (n)) | ((x) >> (32 - (n))))
+
+// CRC32 is computed slice-by-8: eight tables let each step fold in eight
+// bytes with independent lookups instead of one byte at a time.
+
+static uint32_t _crc32_table[8][256];
+static bool _crc32_table_ready;
+static uint16_t _crc16_table[256];
+static bool _crc16_table_ready;
+
+static const uint32_t _md5_k[64] =
+{
+    0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE,
+    0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+    0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE,
+    0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+    0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA,
+    0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+    0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED,
+    0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+    0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C,
+    0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+    0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05,
+    0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+    0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039,
+    0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+    0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1,
+    0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391,
+};
+
+static const uint8_t _md5_shift[16] =
+{
+    7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21
+};
+
+static void md5_block(uint32_t *state, const uint8_t *block);
+static void sha1_block(uint32_t *state, const uint8_t *block);
+static void hash_update(hash_context_t *context, const uint8_t *data, int len, void (*block_function)(uint32_t *state, const uint8_t *block));
+static void hash_pad(hash_context_t *context, bool big_endian, void (*block_function)(uint32_t *state, const uint8_t *block));
+
+static void crc32_init_table(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32_POLY : (crc >> 1);
+
+        _crc32_table[0][i] = crc;
+    }
+
+    for (int slice = 1; slice < 8; slice++)
+    {
+        for (int i = 0; i < 256; i++)
+            _crc32_table[slice][i] = (_crc32_table[slice - 1][i] >> 8) ^ _crc32_table[0][_crc32_table[slice - 1][i] & 0xFF];
+    }
+
+    _crc32_table_ready = true;
+}
+
+static void crc16_init_table(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint16_t crc = (uint16_t)(i << 8);
+
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ CRC16_POLY) : (uint16_t)(crc << 1);
+
+        _crc16_table[i] = crc;
+    }
+
+    _crc16_table_ready = true;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, int len)
+{
+    if (!_crc32_table_ready)
+        crc32_init_table();
+
+    while (len >= 8)
+    {
+        uint32_t low = crc ^ LOAD_U32_LE(data);
+        uint32_t high = LOAD_U32_LE(data + 4);
+
+        crc = _crc32_table[7][low & 0xFF] ^ _crc32_table[6][(low >> 8) & 0xFF] ^
+            _crc32_table[5][(low >> 16) & 0xFF] ^ _crc32_table[4][low >> 24] ^
+            _crc32_table[3][high & 0xFF] ^ _crc32_table[2][(high >> 8) & 0xFF] ^
+            _crc32_table[1][(high >> 16) & 0xFF] ^ _crc32_table[0][high >> 24];
+
+        data += 8;
+        len -= 8;
+    }
+
+    for (int i = 0; i < len; i++)
+        crc = _crc32_table[0][(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return crc;
+}
+
+uint32_t crc32_final(uint32_t crc)
+{
+    return crc ^ 0xFFFFFFFF;
+}
+
+uint32_t crc32(const uint8_t *data, int len)
+{
+    return crc32_final(crc32_update(CRC32_INIT, data, len));
+}
+
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, int len)
+{
+    if (!_crc16_table_ready)
+        crc16_init_table();
+
+    for (int i = 0; i < len; i++)
+        crc = (uint16_t)(crc << 8) ^ _crc16_table[((crc >> 8) ^ data[i]) & 0xFF];
+
+    return crc;
+}
+
+void md5_init(hash_context_t *context)
+{
+    context->state[0] = 0x67452301;
+    context->state[1] = 0xEFCDAB89;
+    context->state[2] = 0x98BADCFE;
+    context->state[3] = 0x10325476;
+    context->length = 0;
+    context->used = 0;
+}
+
+void md5_update(hash_context_t *context, const uint8_t *data, int len)
+{
+    hash_update(context, data, len, &md5_block);
+}
+
+void md5_final(hash_context_t *context, uint8_t *digest)
+{
+    hash_pad(context, false, &md5_block);
+
+    for (int i = 0; i < MD5_DIGEST_SIZE; i++)
+        digest[i] = (uint8_t)(context->state[i / 4] >> ((i % 4) * 8));
+}
+
+void sha1_init(hash_context_t *context)
+{
+    context->state[0] = 0x67452301;
+    context->state[1] = 0xEFCDAB89;
+    context->state[2] = 0x98BADCFE;
+    context->state[3] = 0x10325476;
+    context->state[4] = 0xC3D2E1F0;
+    context->length = 0;
+    context->used = 0;
+}
+
+void sha1_update(hash_context_t *context, const uint8_t *data, int len)
+{
+    hash_update(context, data, len, &sha1_block);
+}
+
+void sha1_final(hash_context_t *context, uint8_t *digest)
+{
+    hash_pad(context, true, &sha1_block);
+
+    for (int i = 0; i < SHA1_DIGEST_SIZE; i++)
+        digest[i] = (uint8_t)(context->state[i / 4] >> ((3 - (i % 4)) * 8));
+}
+
+void checksum_set_init(checksum_set_t *set)
+{
+    set->sum8 = 0;
+    set->crc16 = CRC16_INIT;
+    set->crc32 = CRC32_INIT;
+    md5_init(&set->md5);
+    sha1_init(&set->sha1);
+}
+
+// Updates every checksum from the same pass over the data
+
+void checksum_set_update(checksum_set_t *set, const uint8_t *data, int len)
+{
+    uint8_t sum = set->sum8;
+
+    for (int i = 0; i < len; i++)
+        sum += data[i];
+
+    set->sum8 = sum;
+    set->crc16 = crc16_update(set->crc16, data, len);
+    set->crc32 = crc32_update(set->crc32, data, len);
+    md5_update(&set->md5, data, len);
+    sha1_update(&set->sha1, data, len);
+}
+
+void checksum_set_print(const checksum_set_t *set)
+{
+    hash_context_t context;
+    uint8_t digest[SHA1_DIGEST_SIZE];
+
+    printf("Sum8:  0x%02X\r\nCRC16: 0x%04X\r\nCRC32: 0x%08X\r\n", set->sum8, set->crc16, crc32_final(set->crc32));
+
+    context = set->md5;
+    md5_final(&context, digest);
+    printf("MD5:   ");
+    for (int i = 0; i < MD5_DIGEST_SIZE; i++)
+        printf("%02x", digest[i]);
+
+    context = set->sha1;
+    sha1_final(&context, digest);
+    printf("\r\nSHA-1: ");
+    for (int i = 0; i < SHA1_DIGEST_SIZE; i++)
+        printf("%02x", digest[i]);
+    printf("\r\n");
+}
+
+// Parses TYPE@ADDR[:START-END]. TYPE is sum8 (sum of the range), sum8c (the
+// byte which makes the range sum to zero), crc16 or crc32, with an 'le' suffix
+// on the CRCs to store them little endian. The range defaults to the whole
+// device; the checksum's own bytes are always left out of it.
+
+bool checksum_parse_patch(const char *spec, int size, checksum_patch_t *patch)
+{
+    static const struct
+    {
+        const char *name;
+        checksum_type_t type;
+        int width;
+        bool little_endian;
+    } types[] =
+    {
+        { "sum8", ChecksumSum8, 1, false },
+        { "sum8c", ChecksumSum8Complement, 1, false },
+        { "crc16", ChecksumCrc16, 2, false },
+        { "crc16le", ChecksumCrc16, 2, true },
+        { "crc32", ChecksumCrc32, 4, false },
+        { "crc32le", ChecksumCrc32, 4, true },
+    };
+    const char *at = strchr(spec, '@');
+    char *end;
+    int i;
+
+    if (!at)
+        goto bad_spec;
+
+    for (i = 0; i < (int)(sizeof(types) / sizeof(types[0])); i++)
+    {
+        if (strlen(types[i].name) == (size_t)(at - spec) && !_strnicmp(spec, types[i].name, at - spec))
+            break;
+    }
+
+    if (i == (int)(sizeof(types) / sizeof(types[0])))
+        goto bad_spec;
+
+    patch->type = types[i].type;
+    patch->width = types[i].width;
+    patch->little_endian = types[i].little_endian;
+    patch->address = (int)strtol(at + 1, &end, 0);
+    patch->start = 0;
+    patch->end = size - 1;
+
+    if (*end == ':')
+    {
+        patch->start = (int)strtol(end + 1, &end, 0);
+        if (*end != '-')
+            goto bad_spec;
+        patch->end = (int)strtol(end + 1, &end, 0);
+    }
+
+    if (*end || patch->address < 0 || patch->address + patch->width > size ||
+        patch->start < 0 || patch->end >= size || patch->end < patch->start)
+        goto bad_spec;
+
+    return true;
+
+bad_spec:
+    fprintf(stderr, "\r\nChecksum patch must be TYPE@ADDR[:START-END] within the device. TYPE is sum8/sum8c/crc16/crc16le/crc32/crc32le.\r\n");
+    return false;
+}
+
+// Computes the checksum over the patch range, skipping its own location, and
+// stores it in the image. Returns the value stored.
+
+uint32_t checksum_apply_patch(uint8_t *image, const checksum_patch_t *patch)
+{
+    checksum_set_t set;
+    uint32_t value = 0;
+    int before_end = patch->address - 1 < patch->end ? patch->address - 1 : patch->end;
+    int after_start = patch->address + patch->width > patch->start ? patch->address + patch->width : patch->start;
+
+    checksum_set_init(&set);
+
+    if (before_end >= patch->start)
+        checksum_set_update(&set, image + patch->start, before_end - patch->start + 1);
+
+    if (patch->end >= after_start)
+        checksum_set_update(&set, image + after_start, patch->end - after_start + 1);
+
+    switch (patch->type)
+    {
+        case ChecksumSum8:
+            value = set.sum8;
+            break;
+        case ChecksumSum8Complement:
+            value = (uint8_t)(0x100 - set.sum8);
+            break;
+        case ChecksumCrc16:
+            value = set.crc16;
+            break;
+        case ChecksumCrc32:
+            value = crc32_final(set.crc32);
+            break;
+    }
+
+    for (int i = 0; i < patch->width; i++)
+    {
+        int shift = patch->little_endian ? (i * 8) : ((patch->width - 1 - i) * 8);
+        image[patch->address + i] = (uint8_t)(value >> shift);
+    }
+
+    return value;
+}
+
+static void md5_block(uint32_t *state, const uint8_t *block)
+{
+    uint32_t words[16];
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+
+    for (int i = 0; i < 16; i++)
+        words[i] = LOAD_U32_LE(block + (i * 4));
+
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t f;
+        uint32_t temp;
+        int g;
+
+        if (i < 16)
+        {
+            f = (b & c) | (~b & d);
+            g = i;
+        }
+        else if (i < 32)
+        {
+            f = (d & b) | (~d & c);
+            g = ((5 * i) + 1) % 16;
+        }
+        else if (i < 48)
+        {
+            f = b ^ c ^ d;
+            g = ((3 * i) + 5) % 16;
+        }
+        else
+        {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+
+        temp = d;
+        d = c;
+        c = b;
+        f = a + f + _md5_k[i] + words[g];
+        b = b + ROTL32(f, _md5_shift[((i / 16) * 4) + (i % 4)]);
+        a = temp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+static void sha1_block(uint32_t *state, const uint8_t *block)
+{
+    uint32_t words[80];
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+    uint32_t e = state[4];
+
+    for (int i = 0; i < 16; i++)
+        words[i] = LOAD_U32_BE(block + (i * 4));
+
+    for (int i = 16; i < 80; i++)
+        words[i] = ROTL32(words[i - 3] ^ words[i - 8] ^ words[i - 14] ^ words[i - 16], 1);
+
+    for (int i = 0; i < 80; i++)
+    {
+        uint32_t f;
+        uint32_t k;
+        uint32_t temp;
+
+        if (i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if (i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        temp = ROTL32(a, 5) + f + e + k + words[i];
+        e = d;
+        d = c;
+        c = ROTL32(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+// MD5 and SHA-1 share the same 64 byte block buffering and padding; they only
+// differ in the block function and the byte order of the length
+
+static void hash_update(hash_context_t *context, const uint8_t *data, int len, void (*block_function)(uint32_t *state, const uint8_t *block))
+{
+    context->length += len;
+
+    if (context->used)
+    {
+        int fill = 64 - context->used;
+
+        if (len < fill)
+        {
+            memcpy(context->block + context->used, data, len);
+            context->used += len;
+            return;
+        }
+
+        memcpy(context->block + context->used, data, fill);
+        block_function(context->state, context->block);
+        data += fill;
+        len -= fill;
+        context->used = 0;
+    }
+
+    while (len >= 64)
+    {
+        block_function(context->state, data);
+        data += 64;
+        len -= 64;
+    }
+
+    memcpy(context->block, data, len);
+    context->used = len;
+}
+
+static void hash_pad(hash_context_t *context, bool big_endian, void (*block_function)(uint32_t *state, const uint8_t *block))
+{
+    uint64_t bit_length = context->length * 8;
+
+    context->block[context->used++] = 0x80;
+
+    if (context->used > 56)
+    {
+        memset(context->block + context->used, 0, 64 - context->used);
+        block_function(context->state, context->block);
+        context->used = 0;
+    }
+
+    memset(context->block + context->used, 0, 56 - context->used);
+
+    for (int i = 0; i < 8; i++)
+        context->block[56 + i] = (uint8_t)(bit_length >> (big_endian ? ((7 - i) * 8) : (i * 8)));
+
+    block_function(context->state, context->block);
+    context->used = 0;
+}
@@ -0,0 +1,83 @@
+/*
+ *   File:   checksum.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Checksum routines
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__
+
+#define CRC32_INIT      0xFFFFFFFF
+#define CRC16_INIT      0xFFFF
+
+typedef enum
+{
+    ChecksumSum8,
+    ChecksumSum8Complement,
+    ChecksumCrc16,
+    ChecksumCrc32
+} checksum_type_t;
+
+#define MD5_DIGEST_SIZE     16
+#define SHA1_DIGEST_SIZE    20
+
+typedef struct
+{
+    uint32_t state[5];
+    uint64_t length;
+    uint8_t block[64];
+    int used;
+} hash_context_t;
+
+// CRC16 is CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF, unreflected)
+
+typedef struct
+{
+    uint8_t sum8;
+    uint16_t crc16;
+    uint32_t crc32;
+    hash_context_t md5;
+    hash_context_t sha1;
+} checksum_set_t;
+
+typedef struct
+{
+    checksum_type_t type;
+    int width;
+    bool little_endian;
+    int address;
+    int start;
+    int end;
+} checksum_patch_t;
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, int len);
+uint32_t crc32_final(uint32_t crc);
+uint32_t crc32(const uint8_t *data, int len);
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, int len);
+void md5_init(hash_context_t *context);
+void md5_update(hash_context_t *context, const uint8_t *data, int len);
+void md5_final(hash_context_t *context, uint8_t *digest);
+void sha1_init(hash_context_t *context);
+void sha1_update(hash_context_t *context, const uint8_t *data, int len);
+void sha1_final(hash_context_t *context, uint8_t *digest);
+void checksum_set_init(checksum_set_t *set);
+void checksum_set_update(checksum_set_t *set, const uint8_t *data, int len);
+void checksum_set_print(const checksum_set_t *set);
+bool checksum_parse_patch(const char *spec, int size, checksum_patch_t *patch);
+uint32_t checksum_apply_patch(uint8_t *image, const checksum_patch_t *patch);
+
+#endif /* __CHECKSUM_H__ */
@@ -0,0 +1,103 @@
+/*
+ *   File:   device.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Device descriptors
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+
+#include "project.h"
+#include "serial.h"
+#include "pgm.h"
+#include "device.h"
+
+#define NUM_DEVICES     (sizeof(_devices) / sizeof(_devices[0]))
+
+// Everything the host knows about each device type, indexed by the type code
+// the programmer firmware uses. Adding a device the firmware supports is one
+// entry here.
+
+static const device_t _devices[] =
+{
+    [C1702A] =   { "1702A",    0x100,  0x00, 32,  HOST_MIN_VOLTAGE, HOST_MAX_VOLTAGE, DEVICE_CAP_FIXED_PASSES | DEVICE_CAP_BLANK_CHECK },
+    [C2704] =    { "2704",     0x200,  0xFF, 100, 11.5f,            13.0f,            DEVICE_CAP_FIXED_PASSES | DEVICE_CAP_BLANK_CHECK },
+    [C2708] =    { "2708",     0x400,  0xFF, 100, 11.5f,            13.0f,            DEVICE_CAP_FIXED_PASSES | DEVICE_CAP_BLANK_CHECK },
+    [MCM6876X] = { "MCM6876X", 0x2000, 0xFF, 1,   HOST_MIN_VOLTAGE, HOST_MAX_VOLTAGE, DEVICE_CAP_REWRITES | DEVICE_CAP_BLANK_CHECK },
+    [D8748] =    { "8748",     0x400,  0x00, 1,   HOST_MIN_VOLTAGE, HOST_MAX_VOLTAGE, DEVICE_CAP_BLANK_CHECK },
+    [D8749] =    { "8749",     0x800,  0x00, 1,   HOST_MIN_VOLTAGE, HOST_MAX_VOLTAGE, DEVICE_CAP_BLANK_CHECK },
+    [D8741] =    { "8741",     0x400,  0x00, 1,   HOST_MIN_VOLTAGE, HOST_MAX_VOLTAGE, DEVICE_CAP_BLANK_CHECK },
+    [D8742] =    { "8742",     0x800,  0x00, 1,   HOST_MIN_VOLTAGE, HOST_MAX_VOLTAGE, DEVICE_CAP_BLANK_CHECK },
+    [P8048] =    { "8048",     0x400,  0xFF, 1,   HOST_MIN_VOLTAGE, HOST_MAX_VOLTAGE, 0 },
+    [P8049] =    { "8049",     0x800,  0xFF, 1,   HOST_MIN_VOLTAGE, HOST_MAX_VOLTAGE, 0 },
+    [P8050] =    { "8050",     0x1000, 0xFF, 1,   HOST_MIN_VOLTAGE, HOST_MAX_VOLTAGE, 0 },
+    [D8755] =    { "8755",     0x800,  0xFF, 1,   HOST_MIN_VOLTAGE, HOST_MAX_VOLTAGE, DEVICE_CAP_BLANK_CHECK },
+    [P8041] =    { "8041",     0x400,  0xFF, 1,   HOST_MIN_VOLTAGE, HOST_MAX_VOLTAGE, 0 },
+    [P8042] =    { "8042",     0x800,  0xFF, 1,   HOST_MIN_VOLTAGE, HOST_MAX_VOLTAGE, 0 },
+    [TMS2716] =  { "TMS2716",  0x800,  0xFF, 100, HOST_MIN_VOLTAGE, HOST_MAX_VOLTAGE, DEVICE_CAP_FIXED_PASSES | DEVICE_CAP_BLANK_CHECK },
+};
+
+static char *_device_names;
+
+const device_t *device_get(device_type_t dev_type)
+{
+    if (dev_type < 0 || (size_t)dev_type >= NUM_DEVICES)
+        return NULL;
+
+    return &_devices[dev_type];
+}
+
+device_type_t device_find(const char *name)
+{
+    for (size_t i = 0; i < NUM_DEVICES; i++)
+    {
+        if (!_stricmp(name, _devices[i].name))
+            return (device_type_t)i;
+    }
+
+    return NotSet;
+}
+
+int device_count(void)
+{
+    return (int)NUM_DEVICES;
+}
+
+// Returns every device name separated by '/', for the help text. The buffer
+// is sized from the table on first use, so it grows with it.
+
+const char *device_names(void)
+{
+    if (!_device_names)
+    {
+        size_t length = 1;
+
+        for (size_t i = 0; i < NUM_DEVICES; i++)
+            length += strlen(_devices[i].name) + 1;
+
+        _device_names = malloc(length);
+        _device_names[0] = 0;
+
+        for (size_t i = 0; i < NUM_DEVICES; i++)
+        {
+            if (i)
+                strcat(_device_names, "/");
+            strcat(_device_names, _devices[i].name);
+        }
+    }
+
+    return _device_names;
+}
@@ -0,0 +1,50 @@
+/*
+ *   File:   device.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Device descriptors
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEVICE_H__
+#define __DEVICE_H__
+
+// Writes every byte for a fixed number of passes rather than until it sets
+#define DEVICE_CAP_FIXED_PASSES     0x01
+// Writes each byte until it sets, then a further '-r' times
+#define DEVICE_CAP_REWRITES         0x02
+// UV erasable, so a blank chip reads as the erased value throughout
+#define DEVICE_CAP_BLANK_CHECK      0x04
+
+#define HOST_MIN_VOLTAGE            10.0f
+#define HOST_MAX_VOLTAGE            14.0f
+
+typedef struct
+{
+    const char *name;
+    int size;
+    uint8_t erased_value;
+    int default_passes;
+    float min_voltage;
+    float max_voltage;
+    uint32_t capabilities;
+} device_t;
+
+const device_t *device_get(device_type_t dev_type);
+device_type_t device_find(const char *name);
+int device_count(void);
+const char *device_names(void);
+
+#endif /* __DEVICE_H__ */
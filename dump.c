@@ -0,0 +1,439 @@
+/*
+ *   File:   dump.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Streaming read output
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+
+#include "project.h"
+#include "checksum.h"
+#include "hexfile.h"
+#include "dump.h"
+
+// Read data goes to FILE.part as each chunk arrives, so a failed read keeps
+// everything received so far. Only a complete dump is synced and renamed over
+// FILE, so FILE is never left half written. Each output is raw binary, Intel
+// HEX or S-record according to its extension, and all of them are fed from
+// the same chunks. A binary output gets a FILE.sfv sidecar with its CRC32.
+// Every checksum is updated as each chunk arrives, so none of them need
+// another pass over the data. An output named '-' goes straight to stdout,
+// which has no part file to rename and no sidecar.
+//
+// The programmer can't seek, so a resumed read starts again from the
+// beginning. The bytes already in FILE.part are compared with the new read as
+// it passes them, and if they differ (another chip, or another device type)
+// the part file is discarded and the dump starts over from the new read.
+
+typedef struct
+{
+    char *filename;
+    char *part_filename;
+    FILE *file;
+    hex_format_t format;
+    hex_writer_t writer;
+    bool to_stdout;
+} dump_output_t;
+
+static dump_output_t _outputs[DUMP_MAX_OUTPUTS];
+static int _num_outputs;
+static const uint8_t *_dump_buffer;
+static int _dump_written;
+static checksum_set_t _dump_checksums;
+static bool _dump_failed;
+static FILE *_dump_stdout;
+static uint8_t *_dump_prefix;
+static int _dump_prefix_size;
+static int _dump_checked;
+static bool _dump_discarded;
+
+static char *make_filename(const char *filename, const char *extension);
+static bool sync_file(FILE *file);
+static bool write_sidecar(const char *filename);
+static void discard_prefix(void);
+
+// Takes over stdout for the dump. Everything printed from then on, progress
+// included, goes to stderr so it can't end up in the data.
+
+bool dump_claim_stdout(void)
+{
+    int fd;
+
+    fflush(stdout);
+
+#ifdef _WIN32
+    if ((fd = _dup(_fileno(stdout))) < 0 || !(_dump_stdout = _fdopen(fd, "wb")))
+#else
+    if ((fd = dup(STDOUT_FILENO)) < 0 || !(_dump_stdout = fdopen(fd, "wb")))
+#endif /* _WIN32 */
+    {
+        fprintf(stderr, "\r\nFailed to open standard output for writing.\r\n");
+        return false;
+    }
+
+#ifdef _WIN32
+    _setmode(fd, _O_BINARY);
+    _dup2(_fileno(stderr), _fileno(stdout));
+#else
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+#endif /* _WIN32 */
+
+    // Unbuffered like stderr, so the two stay in order
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    return true;
+}
+
+// Returns the real stdout once it has been claimed, otherwise NULL
+
+FILE *dump_get_stdout(void)
+{
+    return _dump_stdout;
+}
+
+// Returns the number of bytes already in the dump, which is more than zero
+// only when resuming a partial dump, or -1 on failure
+
+int dump_begin(char * const *filenames, int num_filenames, const uint8_t *buffer, int size, bool resume)
+{
+    _num_outputs = 0;
+    _dump_buffer = buffer;
+    _dump_written = 0;
+    checksum_set_init(&_dump_checksums);
+    _dump_failed = false;
+    _dump_prefix_size = 0;
+    _dump_checked = 0;
+    _dump_discarded = false;
+
+    for (int i = 0; i < num_filenames && i < DUMP_MAX_OUTPUTS; i++)
+    {
+        dump_output_t *output = &_outputs[_num_outputs++];
+
+        memset(output, 0, sizeof(dump_output_t));
+        output->filename = _strdup(filenames[i]);
+        output->to_stdout = !strcmp(filenames[i], STDIO_FILENAME);
+
+        if (output->to_stdout)
+            output->format = HexFormatBinary;
+        else
+        {
+            output->part_filename = make_filename(filenames[i], DUMP_PART_EXTENSION);
+            output->format = hexfile_format(filenames[i]);
+        }
+    }
+
+    // Only raw binary can be picked up part way through, as it is the only
+    // format where the bytes in the file are the bytes read
+    if (resume)
+    {
+        dump_output_t *output = &_outputs[0];
+        size_t file_read;
+
+        if (_num_outputs != 1 || output->format != HexFormatBinary || output->to_stdout)
+        {
+            fprintf(stderr, "\r\nOnly a read to a single binary file can be resumed.\r\n");
+            dump_end(false);
+            return -1;
+        }
+
+#ifdef _WIN32
+        if (fopen_s(&output->file, output->part_filename, "a+b"))
+#else
+        if (!(output->file = fopen(output->part_filename, "a+b")))
+#endif /* _WIN32 */
+            goto open_failed;
+
+        fseek(output->file, 0, SEEK_SET);
+
+        // One byte over the device size is enough to tell it is too large
+        _dump_prefix = malloc(size + 1);
+        file_read = fread(_dump_prefix, sizeof(uint8_t), size + 1, output->file);
+
+        if (file_read > (size_t)size)
+        {
+            fprintf(stderr, "\r\nPartial dump %s is larger than the device.\r\n", output->part_filename);
+            dump_end(false);
+            return -1;
+        }
+
+        _dump_prefix_size = (int)file_read;
+        _dump_written = _dump_prefix_size;
+        checksum_set_update(&_dump_checksums, _dump_prefix, _dump_prefix_size);
+
+        return _dump_written;
+    }
+
+    for (int i = 0; i < _num_outputs; i++)
+    {
+        dump_output_t *output = &_outputs[i];
+
+        if (output->to_stdout)
+        {
+            if (!(output->file = _dump_stdout))
+                goto open_failed;
+            continue;
+        }
+
+#ifdef _WIN32
+        if (fopen_s(&output->file, output->part_filename, "wb"))
+#else
+        if (!(output->file = fopen(output->part_filename, "wb")))
+#endif /* _WIN32 */
+            goto open_failed;
+
+        if (output->format != HexFormatBinary)
+            hexfile_write_begin(&output->writer, output->file, output->filename);
+    }
+
+    return 0;
+
+open_failed:
+    fprintf(stderr, "\r\nFailed to open output file for writing.\r\n");
+    for (int i = 0; i < _num_outputs; i++)
+    {
+        if (!_outputs[i].file)
+            break;
+        if (_outputs[i].to_stdout)
+        {
+            _outputs[i].file = NULL;
+            continue;
+        }
+        fclose(_outputs[i].file);
+        _outputs[i].file = NULL;
+        remove(_outputs[i].part_filename);
+    }
+    dump_end(false);
+    return -1;
+}
+
+// Read chunk callback. Writes whatever has arrived since the last call to
+// every output and skips anything a resumed dump already holds.
+
+void dump_chunk_read(int bytes_read)
+{
+    const uint8_t *data;
+    int length;
+
+    if (_dump_prefix && !_dump_failed)
+    {
+        int end = bytes_read < _dump_prefix_size ? bytes_read : _dump_prefix_size;
+
+        if (end > _dump_checked && memcmp(_dump_buffer + _dump_checked, _dump_prefix + _dump_checked, end - _dump_checked))
+            discard_prefix();
+        else if (end > _dump_checked)
+            _dump_checked = end;
+    }
+
+    data = _dump_buffer + _dump_written;
+    length = bytes_read - _dump_written;
+
+    if (_dump_failed || length <= 0)
+        return;
+
+    for (int i = 0; i < _num_outputs; i++)
+    {
+        dump_output_t *output = &_outputs[i];
+
+        if (!output->file)
+            continue;
+
+        if (output->format == HexFormatBinary)
+        {
+            if (fwrite(data, sizeof(uint8_t), length, output->file) != (size_t)length)
+                _dump_failed = true;
+        }
+        else
+        {
+            hexfile_write_data(&output->writer, data, length);
+            if (output->writer.failed)
+                _dump_failed = true;
+        }
+
+        if (fflush(output->file))
+            _dump_failed = true;
+    }
+
+    checksum_set_update(&_dump_checksums, data, length);
+    _dump_written = bytes_read;
+}
+
+bool dump_end(bool completed)
+{
+    bool success = !_dump_failed;
+
+    for (int i = 0; i < _num_outputs; i++)
+    {
+        dump_output_t *output = &_outputs[i];
+
+        if (!output->file)
+            continue;
+
+        if (completed && output->format != HexFormatBinary && !hexfile_write_end(&output->writer))
+            _dump_failed = true;
+
+        // A pipe can't be synced, and stdout stays open until exit
+        if (output->to_stdout)
+        {
+            if (fflush(output->file))
+                _dump_failed = true;
+            output->file = NULL;
+            continue;
+        }
+
+        if (!sync_file(output->file))
+            success = false;
+
+        fclose(output->file);
+        output->file = NULL;
+    }
+
+    if (_dump_failed)
+    {
+        fprintf(stderr, "\r\nFailed to write output file.\r\n");
+        success = false;
+    }
+
+    if (_dump_discarded)
+        fprintf(stderr, "\r\nThe partial dump did not match this device and was discarded.\r\n");
+
+    free(_dump_prefix);
+    _dump_prefix = NULL;
+
+    for (int i = 0; i < _num_outputs; i++)
+    {
+        dump_output_t *output = &_outputs[i];
+
+        if (output->to_stdout)
+        {
+            free(output->filename);
+            continue;
+        }
+
+        if (completed && success)
+        {
+#ifdef _WIN32
+            if (!MoveFileExA(output->part_filename, output->filename, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+#else
+            if (rename(output->part_filename, output->filename))
+#endif /* _WIN32 */
+            {
+                fprintf(stderr, "\r\nFailed to replace output file %s.\r\n", output->filename);
+                success = false;
+            }
+            else if (output->format == HexFormatBinary && !write_sidecar(output->filename))
+            {
+                success = false;
+            }
+        }
+        else if (output->format != HexFormatBinary)
+        {
+            remove(output->part_filename);
+        }
+
+        free(output->filename);
+        free(output->part_filename);
+    }
+
+    _num_outputs = 0;
+
+    return success && completed;
+}
+
+void dump_get_checksums(checksum_set_t *checksums)
+{
+    *checksums = _dump_checksums;
+}
+
+// The part file holds data from another chip. What it holds is thrown away
+// and the dump starts over from the new read, which has everything up to the
+// point it was found to differ.
+
+static void discard_prefix(void)
+{
+    dump_output_t *output = &_outputs[0];
+
+    free(_dump_prefix);
+    _dump_prefix = NULL;
+    _dump_discarded = true;
+
+    fflush(output->file);
+
+#ifdef _WIN32
+    if (_chsize_s(_fileno(output->file), 0))
+#else
+    if (ftruncate(fileno(output->file), 0))
+#endif /* _WIN32 */
+        _dump_failed = true;
+
+    fseek(output->file, 0, SEEK_SET);
+    checksum_set_init(&_dump_checksums);
+    _dump_written = 0;
+}
+
+static char *make_filename(const char *filename, const char *extension)
+{
+    char *result = malloc(strlen(filename) + strlen(extension) + 1);
+
+    strcpy(result, filename);
+    strcat(result, extension);
+
+    return result;
+}
+
+static bool sync_file(FILE *file)
+{
+    if (fflush(file))
+        return false;
+
+#ifdef _WIN32
+    return !_commit(_fileno(file));
+#else
+    return !fsync(fileno(file));
+#endif /* _WIN32 */
+}
+
+static bool write_sidecar(const char *filename)
+{
+    FILE *sidecar_file;
+    char *sidecar_filename = make_filename(filename, DUMP_SFV_EXTENSION);
+    const char *basename = filename;
+    bool success;
+
+    for (const char *pos = filename; *pos; pos++)
+    {
+        if (*pos == '/' || *pos == '\\')
+            basename = pos + 1;
+    }
+
+#ifdef _WIN32
+    if (fopen_s(&sidecar_file, sidecar_filename, "w"))
+#else
+    if (!(sidecar_file = fopen(sidecar_filename, "w")))
+#endif /* _WIN32 */
+    {
+        fprintf(stderr, "\r\nFailed to open checksum file for writing.\r\n");
+        free(sidecar_filename);
+        return false;
+    }
+
+    success = fprintf(sidecar_file, "%s %08X\n", basename, crc32_final(_dump_checksums.crc32)) > 0;
+    success = sync_file(sidecar_file) && success;
+    fclose(sidecar_file);
+    free(sidecar_filename);
+
+    return success;
+}
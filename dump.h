@@ -0,0 +1,35 @@
+/*
+ *   File:   dump.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Streaming read output
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DUMP_H__
+#define __DUMP_H__
+
+#define DUMP_PART_EXTENSION     ".part"
+#define DUMP_SFV_EXTENSION      ".sfv"
+#define DUMP_MAX_OUTPUTS        8
+
+bool dump_claim_stdout(void);
+FILE *dump_get_stdout(void);
+int dump_begin(char * const *filenames, int num_filenames, const uint8_t *buffer, int size, bool resume);
+void dump_chunk_read(int bytes_read);
+bool dump_end(bool completed);
+void dump_get_checksums(checksum_set_t *checksums);
+
+#endif /* __DUMP_H__ */
@@ -0,0 +1,441 @@
+/*
+ *   File:   hexfile.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Intel HEX and Motorola S-record input
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+
+#include "project.h"
+#include "hexfile.h"
+
+#define HEX_MAX_LINE        1024
+#define HEX_MAX_RECORD      ((HEX_MAX_LINE - 2) / 2)
+#define HEX_READ_BUFFER     65536
+
+#define IHEX_DATA           0x00
+#define IHEX_EOF            0x01
+#define IHEX_EXT_SEGMENT    0x02
+#define IHEX_START_SEGMENT  0x03
+#define IHEX_EXT_LINEAR     0x04
+#define IHEX_START_LINEAR   0x05
+
+typedef struct
+{
+    uint8_t *buffer;
+    size_t size;
+    uint32_t base_address;
+    bool clip;
+    uint32_t upper_address;
+    int line_number;
+    bool done;
+} hex_context_t;
+
+static int8_t _nibble_table[256];
+static bool _nibble_table_ready;
+
+static void nibble_init_table(void);
+static int decode_record(const char *text, uint8_t *record);
+static bool place_data(hex_context_t *context, uint32_t address, const uint8_t *data, int length);
+static bool parse_intel(hex_context_t *context, const char *line);
+static bool parse_srec(hex_context_t *context, const char *line);
+static void write_line(hex_writer_t *writer, char type, const uint8_t *record, int length);
+static void write_record(hex_writer_t *writer);
+
+hex_format_t hexfile_format(const char *filename)
+{
+    const char *extension = strrchr(filename, '.');
+
+    if (!extension)
+        return HexFormatBinary;
+
+    if (!_stricmp(extension, ".hex") || !_stricmp(extension, ".ihx") || !_stricmp(extension, ".ihex") || !_stricmp(extension, ".mcs"))
+        return HexFormatIntel;
+
+    if (!_stricmp(extension, ".s19") || !_stricmp(extension, ".s28") || !_stricmp(extension, ".s37") || !_stricmp(extension, ".srec") || !_stricmp(extension, ".mot"))
+        return HexFormatSrec;
+
+    return HexFormatBinary;
+}
+
+// Parses the file a line at a time straight into the buffer, which the caller
+// has already filled with the erased value. Record addresses are relative to
+// base_address, the address of the first byte of the buffer. Data outside the
+// buffer is an error, unless clip is set when only part of the file is wanted.
+
+bool hexfile_load(FILE *file, hex_format_t format, uint8_t *buffer, size_t size, uint32_t base_address, bool clip)
+{
+    hex_context_t context;
+    char line[HEX_MAX_LINE];
+
+    memset(&context, 0, sizeof(context));
+    context.buffer = buffer;
+    context.size = size;
+    context.base_address = base_address;
+    context.clip = clip;
+
+    if (!_nibble_table_ready)
+        nibble_init_table();
+
+    setvbuf(file, NULL, _IOFBF, HEX_READ_BUFFER);
+
+    while (!context.done && fgets(line, sizeof(line), file))
+    {
+        int len = (int)strlen(line);
+
+        context.line_number++;
+
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n' && !feof(file))
+        {
+            fprintf(stderr, "\r\nInput file line %d is too long.\r\n", context.line_number);
+            return false;
+        }
+
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t'))
+            line[--len] = 0;
+
+        if (!len)
+            continue;
+
+        if (!(format == HexFormatIntel ? parse_intel(&context, line) : parse_srec(&context, line)))
+            return false;
+    }
+
+    if (!context.done)
+    {
+        fprintf(stderr, "\r\nInput file has no end record. File may be truncated.\r\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void nibble_init_table(void)
+{
+    memset(_nibble_table, -1, sizeof(_nibble_table));
+
+    for (int i = 0; i < 10; i++)
+        _nibble_table['0' + i] = (int8_t)i;
+
+    for (int i = 0; i < 6; i++)
+    {
+        _nibble_table['A' + i] = (int8_t)(10 + i);
+        _nibble_table['a' + i] = (int8_t)(10 + i);
+    }
+
+    _nibble_table_ready = true;
+}
+
+// Decodes the hex digits following the record mark. Returns the number of
+// bytes, or -1 if the text is not an even number of hex digits.
+
+static int decode_record(const char *text, uint8_t *record)
+{
+    int length = 0;
+
+    while (text[0])
+    {
+        int8_t high = _nibble_table[(uint8_t)text[0]];
+        int8_t low = _nibble_table[(uint8_t)text[1]];
+
+        if (high < 0 || low < 0 || length >= HEX_MAX_RECORD)
+            return -1;
+
+        record[length++] = (uint8_t)((high << 4) | low);
+        text += 2;
+    }
+
+    return length;
+}
+
+static bool place_data(hex_context_t *context, uint32_t address, const uint8_t *data, int length)
+{
+    uint32_t offset = address - context->base_address;
+
+    if (context->clip)
+    {
+        for (int i = 0; i < length; i++)
+        {
+            uint32_t byte_address = address + i;
+
+            // Nothing lies past the top of the 32-bit address space
+            if (byte_address < address)
+                break;
+
+            if (byte_address >= context->base_address && (size_t)(byte_address - context->base_address) < context->size)
+                context->buffer[byte_address - context->base_address] = data[i];
+        }
+
+        return true;
+    }
+
+    if (address < context->base_address || offset >= context->size || (size_t)length > context->size - offset)
+    {
+        fprintf(stderr, "\r\nInput file line %d: address 0x%08X is outside the device.\r\n", context->line_number, address);
+        return false;
+    }
+
+    memcpy(context->buffer + offset, data, length);
+
+    return true;
+}
+
+static bool parse_intel(hex_context_t *context, const char *line)
+{
+    uint8_t record[HEX_MAX_RECORD];
+    uint8_t sum = 0;
+    int length;
+    int data_length;
+
+    if (line[0] != ':' || (length = decode_record(line + 1, record)) < 5)
+        goto bad_record;
+
+    data_length = record[0];
+
+    if (length != data_length + 5)
+        goto bad_record;
+
+    for (int i = 0; i < length; i++)
+        sum += record[i];
+
+    if (sum)
+    {
+        fprintf(stderr, "\r\nInput file line %d: checksum mismatch.\r\n", context->line_number);
+        return false;
+    }
+
+    switch (record[3])
+    {
+        case IHEX_DATA:
+            return place_data(context, context->upper_address + ((record[1] << 8) | record[2]), record + 4, data_length);
+        case IHEX_EOF:
+            context->done = true;
+            return true;
+        case IHEX_EXT_SEGMENT:
+            if (data_length != 2)
+                goto bad_record;
+            context->upper_address = (uint32_t)((record[4] << 8) | record[5]) << 4;
+            return true;
+        case IHEX_EXT_LINEAR:
+            if (data_length != 2)
+                goto bad_record;
+            context->upper_address = (uint32_t)((record[4] << 8) | record[5]) << 16;
+            return true;
+        case IHEX_START_SEGMENT:
+        case IHEX_START_LINEAR:
+            return true;
+        default:
+            break;
+    }
+
+bad_record:
+    fprintf(stderr, "\r\nInput file line %d is not a valid Intel HEX record.\r\n", context->line_number);
+    return false;
+}
+
+static bool parse_srec(hex_context_t *context, const char *line)
+{
+    uint8_t record[HEX_MAX_RECORD];
+    uint8_t sum = 0;
+    uint32_t address = 0;
+    int address_length;
+    int length;
+
+    if (line[0] != 'S' || !line[1] || (length = decode_record(line + 2, record)) < 3 || length != record[0] + 1)
+        goto bad_record;
+
+    for (int i = 0; i < length; i++)
+        sum += record[i];
+
+    if (sum != 0xFF)
+    {
+        fprintf(stderr, "\r\nInput file line %d: checksum mismatch.\r\n", context->line_number);
+        return false;
+    }
+
+    switch (line[1])
+    {
+        case '0':
+        case '5':
+        case '6':
+            return true;
+        case '1':
+        case '9':
+            address_length = 2;
+            break;
+        case '2':
+        case '8':
+            address_length = 3;
+            break;
+        case '3':
+        case '7':
+            address_length = 4;
+            break;
+        default:
+            goto bad_record;
+    }
+
+    if (record[0] < address_length + 1)
+        goto bad_record;
+
+    if (line[1] >= '7')
+    {
+        context->done = true;
+        return true;
+    }
+
+    for (int i = 0; i < address_length; i++)
+        address = (address << 8) | record[1 + i];
+
+    return place_data(context, address, record + 1 + address_length, record[0] - address_length - 1);
+
+bad_record:
+    fprintf(stderr, "\r\nInput file line %d is not a valid S-record.\r\n", context->line_number);
+    return false;
+}
+
+// The writer takes data in whatever pieces it arrives and emits a record each
+// time HEX_RECORD_BYTES have built up. S-records use S1, S2 or S3 addresses
+// according to the extension (.s28 and .s37 for the wider ones).
+
+void hexfile_write_begin(hex_writer_t *writer, FILE *file, const char *filename)
+{
+    const char *extension = strrchr(filename, '.');
+    static const uint8_t header[] = { 0x03, 0x00, 0x00 };
+
+    memset(writer, 0, sizeof(hex_writer_t));
+    writer->file = file;
+    writer->format = hexfile_format(filename);
+    writer->address_bytes = 2;
+
+    if (extension && !_stricmp(extension, ".s28"))
+        writer->address_bytes = 3;
+    else if (extension && !_stricmp(extension, ".s37"))
+        writer->address_bytes = 4;
+
+    if (writer->format == HexFormatSrec)
+        write_line(writer, '0', header, sizeof(header));
+}
+
+void hexfile_write_data(hex_writer_t *writer, const uint8_t *data, int length)
+{
+    while (length > 0)
+    {
+        int this_length = HEX_RECORD_BYTES - writer->used;
+
+        if (this_length > length)
+            this_length = length;
+
+        memcpy(writer->record + writer->used, data, this_length);
+        writer->used += this_length;
+        data += this_length;
+        length -= this_length;
+
+        if (writer->used == HEX_RECORD_BYTES)
+            write_record(writer);
+    }
+}
+
+bool hexfile_write_end(hex_writer_t *writer)
+{
+    write_record(writer);
+
+    if (writer->format == HexFormatIntel)
+    {
+        static const uint8_t end[] = { 0x00, 0x00, 0x00, IHEX_EOF };
+        write_line(writer, 0, end, sizeof(end));
+    }
+    else
+    {
+        uint8_t end[5] = { 0 };
+        end[0] = (uint8_t)(writer->address_bytes + 1);
+        write_line(writer, (char)('0' + 11 - writer->address_bytes), end, writer->address_bytes + 1);
+    }
+
+    return !writer->failed;
+}
+
+// Writes one line. record holds everything between the record mark and the
+// checksum; type is the S-record type, or 0 for Intel HEX.
+
+static void write_line(hex_writer_t *writer, char type, const uint8_t *record, int length)
+{
+    char line[HEX_MAX_LINE];
+    int pos = 0;
+    uint8_t sum = 0;
+
+    if (type)
+    {
+        line[pos++] = 'S';
+        line[pos++] = type;
+    }
+    else
+    {
+        line[pos++] = ':';
+    }
+
+    for (int i = 0; i < length; i++)
+    {
+        pos += sprintf(line + pos, "%02X", record[i]);
+        sum += record[i];
+    }
+
+    pos += sprintf(line + pos, "%02X\r\n", type ? (uint8_t)~sum : (uint8_t)(0x100 - sum));
+
+    if (fwrite(line, 1, pos, writer->file) != (size_t)pos)
+        writer->failed = true;
+}
+
+static void write_record(hex_writer_t *writer)
+{
+    uint8_t record[5 + HEX_RECORD_BYTES];
+    int length = 0;
+
+    if (!writer->used)
+        return;
+
+    if (writer->format == HexFormatIntel)
+    {
+        if ((writer->address >> 16) != writer->upper_address)
+        {
+            uint8_t extended[] = { 0x02, 0x00, 0x00, IHEX_EXT_LINEAR, (uint8_t)(writer->address >> 24), (uint8_t)(writer->address >> 16) };
+
+            write_line(writer, 0, extended, sizeof(extended));
+            writer->upper_address = writer->address >> 16;
+        }
+
+        record[length++] = (uint8_t)writer->used;
+        record[length++] = (uint8_t)(writer->address >> 8);
+        record[length++] = (uint8_t)writer->address;
+        record[length++] = IHEX_DATA;
+        memcpy(record + length, writer->record, writer->used);
+        write_line(writer, 0, record, length + writer->used);
+    }
+    else
+    {
+        record[length++] = (uint8_t)(writer->address_bytes + writer->used + 1);
+
+        for (int i = writer->address_bytes - 1; i >= 0; i--)
+            record[length++] = (uint8_t)(writer->address >> (i * 8));
+
+        memcpy(record + length, writer->record, writer->used);
+        write_line(writer, (char)('0' + writer->address_bytes - 1), record, length + writer->used);
+    }
+
+    writer->address += writer->used;
+    writer->used = 0;
+}
@@ -0,0 +1,51 @@
+/*
+ *   File:   hexfile.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Intel HEX and Motorola S-record input
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HEXFILE_H__
+#define __HEXFILE_H__
+
+typedef enum
+{
+    HexFormatBinary,
+    HexFormatIntel,
+    HexFormatSrec
+} hex_format_t;
+
+#define HEX_RECORD_BYTES    16
+
+typedef struct
+{
+    FILE *file;
+    hex_format_t format;
+    int address_bytes;
+    uint32_t address;
+    uint32_t upper_address;
+    uint8_t record[HEX_RECORD_BYTES];
+    int used;
+    bool failed;
+} hex_writer_t;
+
+hex_format_t hexfile_format(const char *filename);
+bool hexfile_load(FILE *file, hex_format_t format, uint8_t *buffer, size_t size, uint32_t base_address, bool clip);
+void hexfile_write_begin(hex_writer_t *writer, FILE *file, const char *filename);
+void hexfile_write_data(hex_writer_t *writer, const uint8_t *data, int length);
+bool hexfile_write_end(hex_writer_t *writer);
+
+#endif /* __HEXFILE_H__ */
@@ -0,0 +1,784 @@
+/*
+ *   File:   image.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Image file handling
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+
+#include "project.h"
+#include "serial.h"
+#include "pgm.h"
+#include "image.h"
+#include "hexfile.h"
+
+#define REPEAT_U64(b) ((uint64_t)(b) * 0x0101010101010101ULL)
+
+static bool image_load_stdin(device_type_t dev_type, const image_select_t *select, const uint8_t **image);
+static bool image_gather(const uint8_t *source, size_t source_size, const image_select_t *select, uint8_t *buffer, int dev_size);
+static bool selection_window(const image_select_t *select, int dev_size, size_t *window);
+static int popcount64(uint64_t value);
+
+// Loads a binary, Intel HEX or S-record image as a device sized view, padded
+// with the device's erased value. The view is shared by every operation in the
+// session. It is always a heap copy, never the mapping itself, so the file
+// changing or shrinking during a long write can't alter what is programmed.
+// With a selection, the view is gathered from one bank or lane of a larger
+// source image.
+
+bool image_load(const char *filename, device_type_t dev_type, uint32_t base_address, const image_select_t *select, const uint8_t **image)
+{
+    FILE *input_file;
+    uint8_t *buffer;
+    uint8_t *source;
+    const uint8_t *mapped;
+    size_t file_size;
+    size_t source_size = 0;
+    image_select_t window_select;
+    int dev_size = pgm_get_dev_size(dev_type);
+    uint8_t erased_value = pgm_get_erased_value(dev_type);
+    hex_format_t format = hexfile_format(filename);
+    bool selecting = select && (select->offset || select->length || select->interleave > 1);
+
+    *image = NULL;
+
+    if (!strcmp(filename, STDIO_FILENAME))
+        return image_load_stdin(dev_type, select, image);
+
+    if (format != HexFormatBinary)
+    {
+#ifdef _WIN32
+        if (fopen_s(&input_file, filename, "rb"))
+#else
+        if (!(input_file = fopen(filename, "rb")))
+#endif /* _WIN32 */
+        {
+            fprintf(stderr, "\r\nFailed to open input file for reading.\r\n");
+            return false;
+        }
+
+        // A selection only needs the window of the source it covers, which
+        // starts 'offset' bytes above the base address. Records outside it
+        // belong to other chips in the set and are dropped.
+        source_size = dev_size;
+        if (selecting)
+        {
+            if (!selection_window(select, dev_size, &source_size) || (uint64_t)base_address + select->offset > UINT32_MAX)
+            {
+                fclose(input_file);
+                return false;
+            }
+        }
+
+        if (!(source = malloc(source_size)))
+        {
+            fprintf(stderr, "\r\nNot enough memory for the selected part of the input file.\r\n");
+            fclose(input_file);
+            return false;
+        }
+
+        memset(source, erased_value, source_size);
+
+        if (!hexfile_load(input_file, format, source, source_size, base_address + (selecting ? select->offset : 0), selecting))
+        {
+            fclose(input_file);
+            free(source);
+            return false;
+        }
+
+        fclose(input_file);
+
+        if (!selecting)
+        {
+            *image = source;
+            return true;
+        }
+
+        buffer = malloc(dev_size);
+        memset(buffer, erased_value, dev_size);
+
+        window_select = *select;
+        window_select.offset = 0;
+
+        if (!image_gather(source, source_size, &window_select, buffer, dev_size))
+        {
+            free(source);
+            free(buffer);
+            return false;
+        }
+
+        free(source);
+        *image = buffer;
+        return true;
+    }
+
+    if (!image_map(filename, &mapped, &file_size))
+        return false;
+
+    if (selecting)
+    {
+        buffer = malloc(dev_size);
+        memset(buffer, erased_value, dev_size);
+
+        if (!image_gather(mapped, file_size, select, buffer, dev_size))
+        {
+            image_unmap(mapped, file_size);
+            free(buffer);
+            return false;
+        }
+
+        image_unmap(mapped, file_size);
+        *image = buffer;
+        return true;
+    }
+
+    if (file_size > (size_t)dev_size)
+    {
+        fprintf(stderr, "\r\nInput file too large for device.\r\n");
+        image_unmap(mapped, file_size);
+        return false;
+    }
+
+    buffer = malloc(dev_size);
+    memset(buffer, erased_value, dev_size);
+
+    if (file_size)
+        memcpy(buffer, mapped, file_size);
+
+    image_unmap(mapped, file_size);
+
+    *image = buffer;
+
+    return true;
+}
+
+// A pipe can't be mapped or sized up front, so a binary image on stdin is read
+// into a buffer no bigger than the device, or the selected window, can use.
+// Anything after a selected window is read and dropped so the writer at the
+// other end of the pipe isn't cut off.
+
+static bool image_load_stdin(device_type_t dev_type, const image_select_t *select, const uint8_t **image)
+{
+    uint8_t discard[256];
+    uint8_t *source;
+    uint8_t *buffer;
+    image_select_t window_select;
+    size_t source_size;
+    size_t source_read = 0;
+    size_t skipped = 0;
+    size_t chunk_read;
+    int dev_size = pgm_get_dev_size(dev_type);
+    uint8_t erased_value = pgm_get_erased_value(dev_type);
+    bool selecting = select && (select->offset || select->length || select->interleave > 1);
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif /* _WIN32 */
+
+    source_size = dev_size;
+    if (selecting && !selection_window(select, dev_size, &source_size))
+        return false;
+
+    if (!(source = malloc(source_size)))
+    {
+        fprintf(stderr, "\r\nNot enough memory for the selected part of the input file.\r\n");
+        return false;
+    }
+
+    memset(source, erased_value, source_size);
+
+    // Everything before the window is read and dropped
+    while (selecting && skipped < select->offset)
+    {
+        size_t wanted = select->offset - skipped < sizeof(discard) ? select->offset - skipped : sizeof(discard);
+
+        if (!(chunk_read = fread(discard, sizeof(uint8_t), wanted, stdin)))
+            break;
+
+        skipped += chunk_read;
+    }
+
+    if (selecting && skipped < select->offset && !ferror(stdin))
+    {
+        fprintf(stderr, "\r\nOffset is beyond the end of the input file.\r\n");
+        free(source);
+        return false;
+    }
+
+    while (source_read < source_size && (chunk_read = fread(source + source_read, sizeof(uint8_t), source_size - source_read, stdin)) > 0)
+        source_read += chunk_read;
+
+    if (ferror(stdin))
+    {
+        fprintf(stderr, "\r\nFailed to read all of input file.\r\n");
+        free(source);
+        return false;
+    }
+
+    if (!selecting)
+    {
+        if (getc(stdin) != EOF)
+        {
+            fprintf(stderr, "\r\nInput file too large for device.\r\n");
+            free(source);
+            return false;
+        }
+
+        *image = source;
+        return true;
+    }
+
+    while (fread(discard, sizeof(uint8_t), sizeof(discard), stdin) > 0)
+        ;
+
+    buffer = malloc(dev_size);
+    memset(buffer, erased_value, dev_size);
+
+    window_select = *select;
+    window_select.offset = 0;
+
+    if (!image_gather(source, source_read, &window_select, buffer, dev_size))
+    {
+        free(source);
+        free(buffer);
+        return false;
+    }
+
+    free(source);
+    *image = buffer;
+    return true;
+}
+
+// Copies every interleave'th byte, starting at lane, from the selected window
+// of the source into the device buffer
+
+// Works out how much of the source a selection covers, from its offset onwards.
+// A window the device can't hold, or one running past 4GB, is refused.
+
+static bool selection_window(const image_select_t *select, int dev_size, size_t *window)
+{
+    uint64_t largest = (uint64_t)dev_size * (select->interleave > 1 ? select->interleave : 1);
+    uint64_t length = select->length ? select->length : largest;
+
+    if (length > largest)
+    {
+        fprintf(stderr, "\r\nSelected part of input file too large for device.\r\n");
+        return false;
+    }
+
+    if ((uint64_t)select->offset + length > (uint64_t)UINT32_MAX + 1 || length > SIZE_MAX)
+    {
+        fprintf(stderr, "\r\nSelected part of input file runs past the 4GB address limit.\r\n");
+        return false;
+    }
+
+    *window = (size_t)length;
+
+    return true;
+}
+
+static bool image_gather(const uint8_t *source, size_t source_size, const image_select_t *select, uint8_t *buffer, int dev_size)
+{
+    const uint8_t *lane_start;
+    size_t interleave = select->interleave > 1 ? select->interleave : 1;
+    size_t span;
+    size_t count = 0;
+
+    if (select->offset > source_size)
+    {
+        fprintf(stderr, "\r\nOffset is beyond the end of the input file.\r\n");
+        return false;
+    }
+
+    span = source_size - select->offset;
+
+    if (select->length && select->length < span)
+        span = select->length;
+
+    if (span > (size_t)select->lane)
+        count = (span - select->lane + interleave - 1) / interleave;
+
+    if (count > (size_t)dev_size)
+    {
+        fprintf(stderr, "\r\nSelected part of input file too large for device.\r\n");
+        return false;
+    }
+
+    lane_start = source + select->offset + select->lane;
+
+    for (size_t i = 0; i < count; i++)
+        buffer[i] = lane_start[i * interleave];
+
+    return true;
+}
+
+// Maps a whole file read-only. An empty file succeeds with no mapping, as
+// neither mmap nor MapViewOfFile accept a zero length.
+
+bool image_map(const char *filename, const uint8_t **data, size_t *size)
+{
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+    LARGE_INTEGER file_size;
+
+    *data = NULL;
+    *size = 0;
+
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "\r\nFailed to open input file for reading.\r\n");
+        return false;
+    }
+
+    if (!GetFileSizeEx(file, &file_size))
+    {
+        fprintf(stderr, "\r\nFailed to read all of input file.\r\n");
+        CloseHandle(file);
+        return false;
+    }
+
+    if (!file_size.QuadPart)
+    {
+        CloseHandle(file);
+        return true;
+    }
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (mapping)
+    {
+        *data = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+    }
+
+    CloseHandle(file);
+
+    if (!*data)
+    {
+        fprintf(stderr, "\r\nFailed to read all of input file.\r\n");
+        return false;
+    }
+
+    *size = (size_t)file_size.QuadPart;
+#else
+    int fd;
+    struct stat file_stat;
+    void *mapping;
+
+    *data = NULL;
+    *size = 0;
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+    {
+        fprintf(stderr, "\r\nFailed to open input file for reading.\r\n");
+        return false;
+    }
+
+    if (fstat(fd, &file_stat) < 0)
+    {
+        fprintf(stderr, "\r\nFailed to read all of input file.\r\n");
+        close(fd);
+        return false;
+    }
+
+    if (!file_stat.st_size)
+    {
+        close(fd);
+        return true;
+    }
+
+    mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "\r\nFailed to read all of input file.\r\n");
+        return false;
+    }
+
+    *data = (const uint8_t *)mapping;
+    *size = (size_t)file_stat.st_size;
+#endif /* _WIN32 */
+
+    return true;
+}
+
+void image_unmap(const uint8_t *data, size_t size)
+{
+    if (!data)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap((void *)data, size);
+#endif /* _WIN32 */
+}
+
+// Builds a care mask for verify. SPEC is either a binary file the size of the
+// device in which set bits are don't-care, or a comma separated list of
+// START[-END][:BITS] address ranges which are don't-care in all bits, or only
+// in BITS if given. Bits left set in the returned mask must match.
+
+bool image_load_mask(const char *spec, device_type_t dev_type, uint8_t **care_mask)
+{
+    FILE *mask_file;
+    uint8_t *buffer;
+    int dev_size = pgm_get_dev_size(dev_type);
+    const char *pos = spec;
+
+    *care_mask = NULL;
+
+    buffer = malloc(dev_size);
+    memset(buffer, 0xFF, dev_size);
+
+#ifdef _WIN32
+    if (!fopen_s(&mask_file, spec, "rb"))
+#else
+    if ((mask_file = fopen(spec, "rb")))
+#endif /* _WIN32 */
+    {
+        size_t file_read = fread(buffer, sizeof(uint8_t), dev_size, mask_file);
+
+        fclose(mask_file);
+
+        for (size_t i = 0; i < file_read; i++)
+            buffer[i] = ~buffer[i];
+
+        *care_mask = buffer;
+        return true;
+    }
+
+    while (*pos)
+    {
+        char *end;
+        unsigned long start_addr;
+        unsigned long end_addr;
+        unsigned long bits = 0xFF;
+
+        start_addr = strtoul(pos, &end, 0);
+        if (end == pos)
+            goto bad_spec;
+        end_addr = start_addr;
+        pos = end;
+
+        if (*pos == '-')
+        {
+            end_addr = strtoul(++pos, &end, 0);
+            if (end == pos)
+                goto bad_spec;
+            pos = end;
+        }
+
+        if (*pos == ':')
+        {
+            bits = strtoul(++pos, &end, 0);
+            if (end == pos || bits > 0xFF)
+                goto bad_spec;
+            pos = end;
+        }
+
+        if (end_addr < start_addr || end_addr >= (unsigned long)dev_size)
+            goto bad_spec;
+
+        for (unsigned long addr = start_addr; addr <= end_addr; addr++)
+            buffer[addr] &= ~(uint8_t)bits;
+
+        if (*pos == ',')
+            pos++;
+        else if (*pos)
+            goto bad_spec;
+    }
+
+    *care_mask = buffer;
+    return true;
+
+bad_spec:
+    fprintf(stderr, "\r\nMask is neither a readable file nor a valid address range list.\r\n");
+    free(buffer);
+    return false;
+}
+
+void image_free(const uint8_t *image)
+{
+    if (!image)
+        return;
+
+    free((void *)image);
+}
+
+// Reports every location where the device differs from the image in a bit
+// which the care mask covers, and returns the number of them. A NULL mask
+// compares every bit. Equal words are skipped 8 bytes at a time.
+
+int image_compare(const uint8_t *image, const uint8_t *device, const uint8_t *care_mask, int size,
+    void (*mismatch_callback)(int offset, uint8_t image, uint8_t device, uint8_t care))
+{
+    int mismatches = 0;
+    int offset = 0;
+
+    for (; offset < size; offset += 8)
+    {
+        uint64_t image_word = 0;
+        uint64_t device_word = 0;
+        uint64_t care_word = UINT64_MAX;
+        int length = (size - offset) < 8 ? (size - offset) : 8;
+
+        memcpy(&image_word, image + offset, length);
+        memcpy(&device_word, device + offset, length);
+        if (care_mask)
+            memcpy(&care_word, care_mask + offset, length);
+
+        if (!((image_word ^ device_word) & care_word))
+            continue;
+
+        for (int i = offset; i < offset + length; i++)
+        {
+            uint8_t care = care_mask ? care_mask[i] : 0xFF;
+
+            if ((image[i] ^ device[i]) & care)
+            {
+                mismatches++;
+                if (mismatch_callback)
+                    mismatch_callback(i, image[i], device[i], care);
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+// Counts the bits which differ between two images, 8 bytes at a time. Stops
+// as soon as the count passes limit and returns what it has, so a search
+// only pays in full for images which could still make its list.
+
+int image_distance(const uint8_t *a, const uint8_t *b, int size, int limit)
+{
+    int distance = 0;
+
+    for (int offset = 0; offset < size; offset += 8)
+    {
+        uint64_t a_word = 0;
+        uint64_t b_word = 0;
+        int length = (size - offset) < 8 ? (size - offset) : 8;
+
+        memcpy(&a_word, a + offset, length);
+        memcpy(&b_word, b + offset, length);
+
+        distance += popcount64(a_word ^ b_word);
+
+        if (distance > limit)
+            break;
+    }
+
+    return distance;
+}
+
+int image_count_bits(const uint8_t *data, int size)
+{
+    int bits = 0;
+
+    for (int offset = 0; offset < size; offset += 8)
+    {
+        uint64_t word = 0;
+        int length = (size - offset) < 8 ? (size - offset) : 8;
+
+        memcpy(&word, data + offset, length);
+        bits += popcount64(word);
+    }
+
+    return bits;
+}
+
+// Counts, for every bit of the device, how many reads returned it set. votes
+// holds 8 counters per byte, least significant bit first.
+
+void image_add_votes(const uint8_t *device, int size, uint16_t *votes)
+{
+    for (int offset = 0; offset < size; offset++)
+    {
+        uint8_t value = device[offset];
+        uint16_t *byte_votes = votes + (offset * 8);
+
+        for (int bit = 0; bit < 8; bit++)
+            byte_votes[bit] += (value >> bit) & 1;
+    }
+}
+
+// Resolves each bit to the value most reads agreed on and marks the bits which
+// did not read the same every time. A tie resolves to the erased value, so an
+// even split never counts as programmed. Returns the number of unstable bits.
+
+int image_consensus(const uint16_t *votes, int size, int num_reads, uint8_t erased_value, uint8_t *majority, uint8_t *unstable)
+{
+    int unstable_bits = 0;
+
+    for (int offset = 0; offset < size; offset++)
+    {
+        const uint16_t *byte_votes = votes + (offset * 8);
+        uint8_t value = 0;
+        uint8_t unstable_mask = 0;
+
+        for (int bit = 0; bit < 8; bit++)
+        {
+            if (byte_votes[bit] * 2 > num_reads || (byte_votes[bit] * 2 == num_reads && (erased_value & (1 << bit))))
+                value |= (1 << bit);
+
+            if (byte_votes[bit] != 0 && byte_votes[bit] != num_reads)
+            {
+                unstable_mask |= (1 << bit);
+                unstable_bits++;
+            }
+        }
+
+        majority[offset] = value;
+        unstable[offset] = unstable_mask;
+    }
+
+    return unstable_bits;
+}
+
+// Reports every run of non-blank bytes and returns the number of programmed
+// bits. Fully erased words (the common case while a chip is being erased) are
+// skipped 8 bytes at a time.
+
+int image_blank_map(const uint8_t *device, int size, uint8_t erased_value, void (*range_callback)(int offset, int length))
+{
+    uint64_t erased = REPEAT_U64(erased_value);
+    int programmed_bits = 0;
+    int range_start = -1;
+    int offset = 0;
+
+    while (offset < size)
+    {
+        if (offset + 8 <= size)
+        {
+            uint64_t word;
+
+            memcpy(&word, device + offset, 8);
+            word ^= erased;
+
+            if (!word && range_start < 0)
+            {
+                offset += 8;
+                continue;
+            }
+
+            programmed_bits += popcount64(word);
+
+            for (int i = offset; i < offset + 8; i++)
+            {
+                if (device[i] != erased_value && range_start < 0)
+                {
+                    range_start = i;
+                }
+                else if (device[i] == erased_value && range_start >= 0)
+                {
+                    if (range_callback)
+                        range_callback(range_start, i - range_start);
+                    range_start = -1;
+                }
+            }
+
+            offset += 8;
+        }
+        else
+        {
+            programmed_bits += popcount64(device[offset] ^ erased_value);
+
+            if (device[offset] != erased_value && range_start < 0)
+            {
+                range_start = offset;
+            }
+            else if (device[offset] == erased_value && range_start >= 0)
+            {
+                if (range_callback)
+                    range_callback(range_start, offset - range_start);
+                range_start = -1;
+            }
+
+            offset++;
+        }
+    }
+
+    if (range_start >= 0 && range_callback)
+        range_callback(range_start, size - range_start);
+
+    return programmed_bits;
+}
+
+// EPROM bits can only be moved away from their erased state. The device can
+// be taken to the image without an erase as long as no bit programmed on the
+// device needs to be erased in the image. Compared 8 bytes at a time; only
+// words containing a conflict are examined byte by byte.
+
+int image_find_incompatible(const uint8_t *device, const uint8_t *image, int size, uint8_t erased_value,
+    void (*report_callback)(int offset, uint8_t device, uint8_t image))
+{
+    uint64_t erased = REPEAT_U64(erased_value);
+    int incompatible = 0;
+    int offset = 0;
+
+    for (; offset + 8 <= size; offset += 8)
+    {
+        uint64_t device_word;
+        uint64_t image_word;
+
+        memcpy(&device_word, device + offset, 8);
+        memcpy(&image_word, image + offset, 8);
+
+        if (!((device_word ^ erased) & ~(image_word ^ erased)))
+            continue;
+
+        for (int i = offset; i < offset + 8; i++)
+        {
+            if ((device[i] ^ erased_value) & ~(image[i] ^ erased_value))
+            {
+                incompatible++;
+                if (report_callback)
+                    report_callback(i, device[i], image[i]);
+            }
+        }
+    }
+
+    for (; offset < size; offset++)
+    {
+        if ((device[offset] ^ erased_value) & ~(image[offset] ^ erased_value))
+        {
+            incompatible++;
+            if (report_callback)
+                report_callback(offset, device[offset], image[offset]);
+        }
+    }
+
+    return incompatible;
+}
+
+static int popcount64(uint64_t value)
+{
+#ifdef __GNUC__
+    return __builtin_popcountll(value);
+#else
+    value = value - ((value >> 1) & 0x5555555555555555ULL);
+    value = (value & 0x3333333333333333ULL) + ((value >> 2) & 0x3333333333333333ULL);
+    value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((value * 0x0101010101010101ULL) >> 56);
+#endif
+}
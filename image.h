@@ -0,0 +1,47 @@
+/*
+ *   File:   image.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Image file handling
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t length;
+    int interleave;
+    int lane;
+} image_select_t;
+
+bool image_load(const char *filename, device_type_t dev_type, uint32_t base_address, const image_select_t *select, const uint8_t **image);
+void image_free(const uint8_t *image);
+bool image_map(const char *filename, const uint8_t **data, size_t *size);
+void image_unmap(const uint8_t *data, size_t size);
+bool image_load_mask(const char *spec, device_type_t dev_type, uint8_t **care_mask);
+int image_compare(const uint8_t *image, const uint8_t *device, const uint8_t *care_mask, int size,
+    void (*mismatch_callback)(int offset, uint8_t image, uint8_t device, uint8_t care));
+int image_distance(const uint8_t *a, const uint8_t *b, int size, int limit);
+int image_count_bits(const uint8_t *data, int size);
+void image_add_votes(const uint8_t *device, int size, uint16_t *votes);
+int image_consensus(const uint16_t *votes, int size, int num_reads, uint8_t erased_value, uint8_t *majority, uint8_t *unstable);
+int image_blank_map(const uint8_t *device, int size, uint8_t erased_value, void (*range_callback)(int offset, int length));
+int image_find_incompatible(const uint8_t *device, const uint8_t *image, int size, uint8_t erased_value,
+    void (*report_callback)(int offset, uint8_t device, uint8_t image));
+
+#endif /* __IMAGE_H__ */
@@ -0,0 +1,842 @@
+/*
+ *   File:   library.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Known ROM library
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+
+#include "project.h"
+#include "serial.h"
+#include "pgm.h"
+#include "image.h"
+#include "library.h"
+
+#define LIBRARY_MAGIC           0x4C525648 // "HVRL"
+#define LIBRARY_VERSION         3
+
+#define FNV_OFFSET_BASIS        0xCBF29CE484222325ULL
+#define FNV_PRIME               0x00000100000001B3ULL
+#define ROLL_BASE               0x9E3779B97F4A7C15ULL
+
+// A block found in more places than this, such as a run of erased bytes,
+// says little about where the dump is and would flood the search
+#define LOCATE_MAX_HITS         256
+
+// The library is a single file built from a directory of dumps, used in
+// place through a read-only mapping:
+//
+//   header
+//   ROM table, sorted by hash
+//   prefix hashes, one per block of each ROM
+//   block table, sorted by hash
+//   images, each padded to 8 bytes
+//   names, NUL terminated
+//
+// A ROM's hash is FNV-1a over the whole image. Its prefix hashes are the
+// FNV-1a state at the end of each LIBRARY_BLOCK_SIZE block, so a read can be
+// checked against every candidate at each block boundary with one compare,
+// using the state it is already carrying. The images themselves are kept for
+// nearest match searches.
+//
+// The block table has a polynomial hash of every whole, aligned block of
+// every ROM. Any stretch of a ROM at least two blocks long, less a byte,
+// contains one whole aligned block, so rolling the same hash across a dump
+// finds where it sits in larger ROMs from its own blocks alone. If it nearly
+// sits there, any block without a wrong bit in it does the same. Everything
+// is in host byte order.
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t num_roms;
+    uint32_t num_prefixes;
+    uint32_t num_blocks;
+    uint32_t data_size;
+    uint32_t names_size;
+} library_header_t;
+
+typedef struct
+{
+    uint64_t hash;
+    uint32_t size;
+    uint32_t name_offset;
+    uint32_t prefix_index;
+    uint32_t data_offset;
+    uint32_t set_bits;
+    uint32_t reserved;
+} library_rom_t;
+
+typedef struct
+{
+    uint64_t hash;
+    uint32_t rom;
+    uint32_t block;
+} library_block_t;
+
+typedef struct
+{
+    uint32_t rom;
+    int bound;
+} library_nearest_t;
+
+typedef struct
+{
+    uint32_t rom;
+    uint32_t offset;
+} library_hit_t;
+
+static const uint8_t *_library_data;
+static size_t _library_size;
+static const library_header_t *_header;
+static const library_rom_t *_roms;
+static const uint64_t *_prefixes;
+static const library_block_t *_blocks;
+static const uint8_t *_data;
+static const char *_names;
+
+static uint32_t *_candidates;
+static int _num_candidates;
+static const uint8_t *_read_buffer;
+static int _read_size;
+static int _hashed;
+static uint64_t _read_hash;
+static int _unique_offset;
+
+static library_rom_t *_build_roms;
+static int _build_num_roms;
+static uint64_t *_build_prefixes;
+static int _build_num_prefixes;
+static library_block_t *_build_blocks;
+static int _build_num_blocks;
+static uint8_t *_build_data;
+static size_t _build_data_size;
+static char *_build_names;
+static int _build_names_size;
+
+static uint64_t fnv_update(uint64_t hash, const uint8_t *data, int length);
+static uint64_t roll_hash(const uint8_t *data, int length);
+static void build_blocks(void);
+static bool add_directory(const char *path, const char *name);
+static void add_file(const char *path, const char *name);
+static char *join_path(const char *directory, char separator, const char *name);
+static int compare_roms(const void *a, const void *b);
+static int compare_bounds(const void *a, const void *b);
+static int compare_blocks(const void *a, const void *b);
+static int compare_hits(const void *a, const void *b);
+static void narrow_candidates(int block);
+static bool candidates_identical(void);
+
+// Indexes every file under the directory, including subdirectories. Each ROM
+// is named by its path relative to the directory.
+
+bool library_build(const char *directory, const char *filename)
+{
+    library_header_t header;
+    FILE *library_file = NULL;
+    bool success = false;
+
+    _build_roms = NULL;
+    _build_num_roms = 0;
+    _build_prefixes = NULL;
+    _build_num_prefixes = 0;
+    _build_blocks = NULL;
+    _build_num_blocks = 0;
+    _build_data = NULL;
+    _build_data_size = 0;
+    _build_names = NULL;
+    _build_names_size = 0;
+
+    if (!add_directory(directory, NULL))
+        goto out;
+
+    if (!_build_num_roms)
+    {
+        fprintf(stderr, "\r\nNo ROM images found in %s.\r\n", directory);
+        goto out;
+    }
+
+    qsort(_build_roms, _build_num_roms, sizeof(library_rom_t), &compare_roms);
+    build_blocks();
+
+    memset(&header, 0, sizeof(header));
+    header.magic = LIBRARY_MAGIC;
+    header.version = LIBRARY_VERSION;
+    header.block_size = LIBRARY_BLOCK_SIZE;
+    header.num_roms = _build_num_roms;
+    header.num_prefixes = _build_num_prefixes;
+    header.num_blocks = _build_num_blocks;
+    header.data_size = (uint32_t)_build_data_size;
+    header.names_size = _build_names_size;
+
+#ifdef _WIN32
+    if (fopen_s(&library_file, filename, "wb"))
+#else
+    if (!(library_file = fopen(filename, "wb")))
+#endif /* _WIN32 */
+    {
+        fprintf(stderr, "\r\nFailed to open library file for writing.\r\n");
+        goto out;
+    }
+
+    if (fwrite(&header, sizeof(header), 1, library_file) != 1 ||
+        fwrite(_build_roms, sizeof(library_rom_t), _build_num_roms, library_file) != (size_t)_build_num_roms ||
+        fwrite(_build_prefixes, sizeof(uint64_t), _build_num_prefixes, library_file) != (size_t)_build_num_prefixes ||
+        fwrite(_build_blocks, sizeof(library_block_t), _build_num_blocks, library_file) != (size_t)_build_num_blocks ||
+        fwrite(_build_data, sizeof(uint8_t), _build_data_size, library_file) != _build_data_size ||
+        fwrite(_build_names, sizeof(char), _build_names_size, library_file) != (size_t)_build_names_size)
+    {
+        fprintf(stderr, "\r\nFailed to write library file.\r\n");
+        goto out;
+    }
+
+    printf("\r\nIndexed %d ROM images from %s into %s.\r\n", _build_num_roms, directory, filename);
+
+    success = true;
+
+out:
+    if (library_file && fclose(library_file))
+        success = false;
+    if (_build_roms)
+        free(_build_roms);
+    if (_build_prefixes)
+        free(_build_prefixes);
+    if (_build_blocks)
+        free(_build_blocks);
+    if (_build_data)
+        free(_build_data);
+    if (_build_names)
+        free(_build_names);
+
+    return success;
+}
+
+bool library_open(const char *filename)
+{
+    size_t expected_size;
+
+    if (!image_map(filename, &_library_data, &_library_size))
+        return false;
+
+    _header = (const library_header_t *)_library_data;
+
+    if (_library_size < sizeof(library_header_t) || _header->magic != LIBRARY_MAGIC ||
+        _header->version != LIBRARY_VERSION || _header->block_size != LIBRARY_BLOCK_SIZE)
+        goto invalid;
+
+    expected_size = sizeof(library_header_t) + (size_t)_header->num_roms * sizeof(library_rom_t) +
+        (size_t)_header->num_prefixes * sizeof(uint64_t) + (size_t)_header->num_blocks * sizeof(library_block_t) +
+        _header->data_size + _header->names_size;
+
+    if (_library_size != expected_size || !_header->names_size)
+        goto invalid;
+
+    _roms = (const library_rom_t *)(_header + 1);
+    _prefixes = (const uint64_t *)(_roms + _header->num_roms);
+    _blocks = (const library_block_t *)(_prefixes + _header->num_prefixes);
+    _data = (const uint8_t *)(_blocks + _header->num_blocks);
+    _names = (const char *)(_data + _header->data_size);
+
+    if (_names[_header->names_size - 1])
+        goto invalid;
+
+    for (uint32_t i = 0; i < _header->num_roms; i++)
+    {
+        uint32_t num_blocks = (_roms[i].size + LIBRARY_BLOCK_SIZE - 1) / LIBRARY_BLOCK_SIZE;
+
+        if (_roms[i].size > LIBRARY_MAX_ROM_SIZE || _roms[i].name_offset >= _header->names_size ||
+            _roms[i].prefix_index > _header->num_prefixes || num_blocks > _header->num_prefixes - _roms[i].prefix_index ||
+            _roms[i].data_offset > _header->data_size || _roms[i].size > _header->data_size - _roms[i].data_offset)
+            goto invalid;
+    }
+
+    for (uint32_t i = 0; i < _header->num_blocks; i++)
+    {
+        if (_blocks[i].rom >= _header->num_roms || _blocks[i].block >= _roms[_blocks[i].rom].size / LIBRARY_BLOCK_SIZE)
+            goto invalid;
+    }
+
+    return true;
+
+invalid:
+    fprintf(stderr, "\r\n%s is not a ROM library.\r\n", filename);
+    library_close();
+    return false;
+}
+
+bool library_active(void)
+{
+    return _library_data != NULL;
+}
+
+void library_close(void)
+{
+    image_unmap(_library_data, _library_size);
+
+    if (_candidates)
+        free(_candidates);
+
+    _library_data = NULL;
+    _header = NULL;
+    _candidates = NULL;
+    _num_candidates = 0;
+}
+
+// Starts narrowing the library down to the ROMs which agree with a read of
+// the given buffer so far. Only ROMs of the read's size are candidates.
+
+void library_begin(const uint8_t *buffer, int size)
+{
+    if (_candidates)
+        free(_candidates);
+
+    _candidates = malloc((_header->num_roms ? _header->num_roms : 1) * sizeof(uint32_t));
+    _num_candidates = 0;
+
+    for (uint32_t i = 0; i < _header->num_roms; i++)
+    {
+        if (_roms[i].size == (uint32_t)size)
+            _candidates[_num_candidates++] = i;
+    }
+
+    _read_buffer = buffer;
+    _read_size = size;
+    _hashed = 0;
+    _read_hash = FNV_OFFSET_BASIS;
+    _unique_offset = candidates_identical() ? 0 : -1;
+}
+
+// Read chunk callback. Chunks don't line up with blocks, so the hash is
+// carried across them and the candidates are narrowed each time a block
+// completes.
+
+void library_chunk_read(int bytes_read)
+{
+    while (_hashed < bytes_read && _num_candidates)
+    {
+        int block_end = (_hashed / LIBRARY_BLOCK_SIZE + 1) * LIBRARY_BLOCK_SIZE;
+        int end;
+
+        if (block_end > _read_size)
+            block_end = _read_size;
+
+        end = block_end < bytes_read ? block_end : bytes_read;
+
+        _read_hash = fnv_update(_read_hash, _read_buffer + _hashed, end - _hashed);
+        _hashed = end;
+
+        if (_hashed == block_end)
+            narrow_candidates((block_end - 1) / LIBRARY_BLOCK_SIZE);
+    }
+}
+
+// Returns the name of the only ROM which still fits the read, or NULL while
+// there are several or none. Identical dumps under different names count as
+// one ROM.
+
+const char *library_unique_name(void)
+{
+    if (!candidates_identical())
+        return NULL;
+
+    return _names + _roms[_candidates[0]].name_offset;
+}
+
+// Returns how many bytes had been read when only one ROM was left, or -1 if
+// that never happened
+
+int library_unique_offset(void)
+{
+    return _unique_offset;
+}
+
+// Looks the whole image up by hash. Identical dumps under different names
+// all match. Returns the number of matches.
+
+int library_identify(const uint8_t *data, int size, void (*match_callback)(const char *name))
+{
+    uint64_t hash = fnv_update(FNV_OFFSET_BASIS, data, size);
+    uint32_t low = 0;
+    uint32_t high = _header->num_roms;
+    int matches = 0;
+
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+
+        if (_roms[mid].hash < hash)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    for (uint32_t i = low; i < _header->num_roms && _roms[i].hash == hash; i++)
+    {
+        if (_roms[i].size != (uint32_t)size)
+            continue;
+
+        if (match_callback)
+            match_callback(_names + _roms[i].name_offset);
+
+        matches++;
+    }
+
+    return matches;
+}
+
+// Lists the ROMs of the image's size which differ from it in the fewest bits,
+// closest first. Two images can't be closer than the difference in how many
+// bits each has set, so ROMs are tried in order of that bound and the search
+// stops once the bound alone rules out the rest. Each distance is also cut
+// short once it can no longer make the list. Returns the number listed.
+
+int library_nearest(const uint8_t *data, int size, int count, void (*match_callback)(const char *name, int distance))
+{
+    library_nearest_t *order;
+    library_nearest_t *best;
+    int set_bits = image_count_bits(data, size);
+    int num_order = 0;
+    int num_best = 0;
+
+    if (count <= 0 || !_header->num_roms)
+        return 0;
+
+    order = malloc(_header->num_roms * sizeof(library_nearest_t));
+    best = malloc(count * sizeof(library_nearest_t));
+
+    for (uint32_t i = 0; i < _header->num_roms; i++)
+    {
+        if (_roms[i].size != (uint32_t)size)
+            continue;
+
+        order[num_order].rom = i;
+        order[num_order].bound = abs((int)_roms[i].set_bits - set_bits);
+        num_order++;
+    }
+
+    qsort(order, num_order, sizeof(library_nearest_t), &compare_bounds);
+
+    for (int i = 0; i < num_order; i++)
+    {
+        int limit = num_best == count ? best[count - 1].bound - 1 : size * 8;
+        int distance;
+        int insert;
+
+        if (order[i].bound > limit)
+            break;
+
+        distance = image_distance(data, _data + _roms[order[i].rom].data_offset, size, limit);
+
+        if (distance > limit)
+            continue;
+
+        // Insertion into the short sorted list, dropping the furthest when full
+        insert = num_best < count ? num_best++ : count - 1;
+
+        while (insert > 0 && best[insert - 1].bound > distance)
+        {
+            best[insert] = best[insert - 1];
+            insert--;
+        }
+
+        best[insert].rom = order[i].rom;
+        best[insert].bound = distance;
+    }
+
+    for (int i = 0; i < num_best; i++)
+    {
+        if (match_callback)
+            match_callback(_names + _roms[best[i].rom].name_offset, best[i].bound);
+    }
+
+    free(order);
+    free(best);
+
+    return num_best;
+}
+
+// Finds every place in the library's ROMs where the dump appears with no
+// more than tolerance bits wrong. Each window of the dump one block long is
+// looked up in the block table as the hash rolls along it, and each hit
+// names a ROM and offset to check. Returns the number of places found.
+
+int library_locate(const uint8_t *data, int size, int tolerance, void (*match_callback)(const char *name, int offset, int distance))
+{
+    library_hit_t *hits = NULL;
+    int num_hits = 0;
+    int max_hits = 0;
+    int found = 0;
+    uint64_t hash;
+    uint64_t power = 1;
+
+    if (size < LIBRARY_LOCATE_MIN_SIZE)
+        return 0;
+
+    for (int i = 1; i < LIBRARY_BLOCK_SIZE; i++)
+        power *= ROLL_BASE;
+
+    hash = roll_hash(data, LIBRARY_BLOCK_SIZE);
+
+    for (int start = 0; start + LIBRARY_BLOCK_SIZE <= size; start++)
+    {
+        uint32_t low = 0;
+        uint32_t high = _header->num_blocks;
+        uint32_t end;
+
+        if (start > 0)
+            hash = (hash - data[start - 1] * power) * ROLL_BASE + data[start + LIBRARY_BLOCK_SIZE - 1];
+
+        while (low < high)
+        {
+            uint32_t mid = low + (high - low) / 2;
+
+            if (_blocks[mid].hash < hash)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+
+        for (end = low; end < _header->num_blocks && _blocks[end].hash == hash; end++)
+            ;
+
+        if (end - low > LOCATE_MAX_HITS)
+            continue;
+
+        for (uint32_t i = low; i < end; i++)
+        {
+            uint32_t block_offset = _blocks[i].block * LIBRARY_BLOCK_SIZE;
+
+            // The dump would have to start before the ROM or run off its end
+            if (block_offset < (uint32_t)start || block_offset - start + size > _roms[_blocks[i].rom].size)
+                continue;
+
+            if (num_hits == max_hits)
+            {
+                max_hits = max_hits ? max_hits * 2 : 64;
+                hits = realloc(hits, max_hits * sizeof(library_hit_t));
+            }
+
+            hits[num_hits].rom = _blocks[i].rom;
+            hits[num_hits].offset = block_offset - start;
+            num_hits++;
+        }
+    }
+
+    // A real match is hit once for every whole block it covers
+    if (num_hits)
+        qsort(hits, num_hits, sizeof(library_hit_t), &compare_hits);
+
+    for (int i = 0; i < num_hits; i++)
+    {
+        const library_rom_t *rom = &_roms[hits[i].rom];
+        int distance;
+
+        if (i > 0 && hits[i].rom == hits[i - 1].rom && hits[i].offset == hits[i - 1].offset)
+            continue;
+
+        distance = image_distance(data, _data + rom->data_offset + hits[i].offset, size, tolerance);
+
+        if (distance > tolerance)
+            continue;
+
+        if (match_callback)
+            match_callback(_names + rom->name_offset, (int)hits[i].offset, distance);
+
+        found++;
+    }
+
+    if (hits)
+        free(hits);
+
+    return found;
+}
+
+static uint64_t fnv_update(uint64_t hash, const uint8_t *data, int length)
+{
+    for (int i = 0; i < length; i++)
+    {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static uint64_t roll_hash(const uint8_t *data, int length)
+{
+    uint64_t hash = 0;
+
+    for (int i = 0; i < length; i++)
+        hash = hash * ROLL_BASE + data[i];
+
+    return hash;
+}
+
+// Hashes every whole block of every ROM. Run once the ROM table is sorted, as
+// the table refers to ROMs by position.
+
+static void build_blocks(void)
+{
+    for (int i = 0; i < _build_num_roms; i++)
+        _build_num_blocks += _build_roms[i].size / LIBRARY_BLOCK_SIZE;
+
+    _build_blocks = malloc((_build_num_blocks ? _build_num_blocks : 1) * sizeof(library_block_t));
+    _build_num_blocks = 0;
+
+    for (int i = 0; i < _build_num_roms; i++)
+    {
+        const uint8_t *data = _build_data + _build_roms[i].data_offset;
+
+        for (uint32_t block = 0; block < _build_roms[i].size / LIBRARY_BLOCK_SIZE; block++)
+        {
+            library_block_t *entry = &_build_blocks[_build_num_blocks++];
+
+            entry->hash = roll_hash(data + block * LIBRARY_BLOCK_SIZE, LIBRARY_BLOCK_SIZE);
+            entry->rom = i;
+            entry->block = block;
+        }
+    }
+
+    qsort(_build_blocks, _build_num_blocks, sizeof(library_block_t), &compare_blocks);
+}
+
+static void narrow_candidates(int block)
+{
+    int kept = 0;
+
+    for (int i = 0; i < _num_candidates; i++)
+    {
+        const library_rom_t *rom = &_roms[_candidates[i]];
+
+        if (_prefixes[rom->prefix_index + block] == _read_hash)
+            _candidates[kept++] = _candidates[i];
+    }
+
+    _num_candidates = kept;
+
+    if (_unique_offset < 0 && candidates_identical())
+        _unique_offset = _hashed;
+}
+
+// Candidates stay in table order, so identical images are next to each other
+
+static bool candidates_identical(void)
+{
+    return _num_candidates && _roms[_candidates[0]].hash == _roms[_candidates[_num_candidates - 1]].hash;
+}
+
+static bool add_directory(const char *path, const char *name)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA find_data;
+    HANDLE find;
+    char *pattern = join_path(path, '\\', "*");
+
+    find = FindFirstFileA(pattern, &find_data);
+    free(pattern);
+
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "\r\nFailed to open directory %s.\r\n", path);
+        return false;
+    }
+
+    do
+    {
+        char *child_path;
+        char *child_name;
+
+        if (find_data.cFileName[0] == '.')
+            continue;
+
+        child_path = join_path(path, '\\', find_data.cFileName);
+        child_name = name ? join_path(name, '/', find_data.cFileName) : _strdup(find_data.cFileName);
+
+        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            add_directory(child_path, child_name);
+        else
+            add_file(child_path, child_name);
+
+        free(child_path);
+        free(child_name);
+    } while (FindNextFileA(find, &find_data));
+
+    FindClose(find);
+#else
+    DIR *dir;
+    struct dirent *entry;
+
+    if (!(dir = opendir(path)))
+    {
+        fprintf(stderr, "\r\nFailed to open directory %s.\r\n", path);
+        return false;
+    }
+
+    while ((entry = readdir(dir)))
+    {
+        struct stat file_stat;
+        char *child_path;
+        char *child_name;
+
+        if (entry->d_name[0] == '.')
+            continue;
+
+        child_path = join_path(path, '/', entry->d_name);
+        child_name = name ? join_path(name, '/', entry->d_name) : _strdup(entry->d_name);
+
+        if (!stat(child_path, &file_stat))
+        {
+            if (S_ISDIR(file_stat.st_mode))
+                add_directory(child_path, child_name);
+            else if (S_ISREG(file_stat.st_mode))
+                add_file(child_path, child_name);
+        }
+
+        free(child_path);
+        free(child_name);
+    }
+
+    closedir(dir);
+#endif /* _WIN32 */
+
+    return true;
+}
+
+// Anything empty, too big for a ROM, or already a library is skipped, so the
+// library file can live in the directory it indexes
+
+static void add_file(const char *path, const char *name)
+{
+    const uint8_t *data;
+    size_t size;
+    library_rom_t *rom;
+    uint64_t hash = FNV_OFFSET_BASIS;
+    int name_length = (int)strlen(name) + 1;
+
+    if (!image_map(path, &data, &size))
+        return;
+
+    if (!size || size > LIBRARY_MAX_ROM_SIZE || (size >= sizeof(uint32_t) && *(const uint32_t *)data == LIBRARY_MAGIC))
+    {
+        image_unmap(data, size);
+        return;
+    }
+
+    // Offsets into the images are 32 bits
+    if (_build_data_size + size + 8 > UINT32_MAX)
+    {
+        fprintf(stderr, "\r\nLibrary is full. Skipped %s.\r\n", name);
+        image_unmap(data, size);
+        return;
+    }
+
+    _build_roms = realloc(_build_roms, (_build_num_roms + 1) * sizeof(library_rom_t));
+    _build_prefixes = realloc(_build_prefixes, (_build_num_prefixes + (size + LIBRARY_BLOCK_SIZE - 1) / LIBRARY_BLOCK_SIZE) * sizeof(uint64_t));
+    _build_names = realloc(_build_names, _build_names_size + name_length);
+    _build_data = realloc(_build_data, _build_data_size + ((size + 7) & ~(size_t)7));
+
+    rom = &_build_roms[_build_num_roms++];
+    memset(rom, 0, sizeof(library_rom_t));
+    rom->size = (uint32_t)size;
+    rom->name_offset = _build_names_size;
+    rom->prefix_index = _build_num_prefixes;
+    rom->data_offset = (uint32_t)_build_data_size;
+    rom->set_bits = image_count_bits(data, (int)size);
+
+    for (size_t offset = 0; offset < size; offset += LIBRARY_BLOCK_SIZE)
+    {
+        int length = size - offset < LIBRARY_BLOCK_SIZE ? (int)(size - offset) : LIBRARY_BLOCK_SIZE;
+
+        hash = fnv_update(hash, data + offset, length);
+        _build_prefixes[_build_num_prefixes++] = hash;
+    }
+
+    rom->hash = hash;
+
+    memcpy(_build_data + _build_data_size, data, size);
+    memset(_build_data + _build_data_size + size, 0, ((size + 7) & ~(size_t)7) - size);
+    _build_data_size += (size + 7) & ~(size_t)7;
+
+    memcpy(_build_names + _build_names_size, name, name_length);
+    _build_names_size += name_length;
+
+    image_unmap(data, size);
+}
+
+static char *join_path(const char *directory, char separator, const char *name)
+{
+    size_t length = strlen(directory);
+    char *result = malloc(length + strlen(name) + 2);
+
+    strcpy(result, directory);
+
+    if (length && directory[length - 1] != '/' && directory[length - 1] != '\\')
+        result[length++] = separator;
+
+    strcpy(result + length, name);
+
+    return result;
+}
+
+static int compare_roms(const void *a, const void *b)
+{
+    const library_rom_t *rom_a = (const library_rom_t *)a;
+    const library_rom_t *rom_b = (const library_rom_t *)b;
+
+    if (rom_a->hash != rom_b->hash)
+        return rom_a->hash < rom_b->hash ? -1 : 1;
+
+    return strcmp(_build_names + rom_a->name_offset, _build_names + rom_b->name_offset);
+}
+
+static int compare_blocks(const void *a, const void *b)
+{
+    const library_block_t *block_a = (const library_block_t *)a;
+    const library_block_t *block_b = (const library_block_t *)b;
+
+    if (block_a->hash != block_b->hash)
+        return block_a->hash < block_b->hash ? -1 : 1;
+
+    if (block_a->rom != block_b->rom)
+        return block_a->rom < block_b->rom ? -1 : 1;
+
+    return block_a->block < block_b->block ? -1 : (block_a->block > block_b->block);
+}
+
+static int compare_hits(const void *a, const void *b)
+{
+    const library_hit_t *hit_a = (const library_hit_t *)a;
+    const library_hit_t *hit_b = (const library_hit_t *)b;
+
+    if (hit_a->rom != hit_b->rom)
+        return hit_a->rom < hit_b->rom ? -1 : 1;
+
+    return hit_a->offset < hit_b->offset ? -1 : (hit_a->offset > hit_b->offset);
+}
+
+static int compare_bounds(const void *a, const void *b)
+{
+    const library_nearest_t *nearest_a = (const library_nearest_t *)a;
+    const library_nearest_t *nearest_b = (const library_nearest_t *)b;
+
+    if (nearest_a->bound != nearest_b->bound)
+        return nearest_a->bound - nearest_b->bound;
+
+    return (int)nearest_a->rom - (int)nearest_b->rom;
+}
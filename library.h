@@ -0,0 +1,40 @@
+/*
+ *   File:   library.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Known ROM library
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBRARY_H__
+#define __LIBRARY_H__
+
+#define LIBRARY_BLOCK_SIZE      64
+#define LIBRARY_MAX_ROM_SIZE    0x1000000
+#define LIBRARY_LOCATE_MIN_SIZE (2 * LIBRARY_BLOCK_SIZE - 1)
+
+bool library_build(const char *directory, const char *filename);
+bool library_open(const char *filename);
+bool library_active(void);
+void library_close(void);
+void library_begin(const uint8_t *buffer, int size);
+void library_chunk_read(int bytes_read);
+const char *library_unique_name(void);
+int library_unique_offset(void);
+int library_identify(const uint8_t *data, int size, void (*match_callback)(const char *name));
+int library_nearest(const uint8_t *data, int size, int count, void (*match_callback)(const char *name, int distance));
+int library_locate(const uint8_t *data, int size, int tolerance, void (*match_callback)(const char *name, int offset, int distance));
+
+#endif /* __LIBRARY_H__ */
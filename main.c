@@ -24,11 +24,56 @@
 #include "getopt.h"
 #include "serial.h"
 #include "pgm.h"
+#include "device.h"
 #include "test.h"
 #include "util.h"
+#include "image.h"
+#include "checksum.h"
+#include "hexfile.h"
+#include "dump.h"
+#include "transform.h"
+#include "library.h"
+#include "checkpoint.h"
+#include "tuning.h"
 
 #define PROGRESS_BAR_SEGMENTS   58
 #define MCM6876X_DEFAULT_RETRIES    5
+#define MAX_OPERATIONS              8
+#define MAX_FILES                   (DUMP_MAX_OUTPUTS + 1)
+#define MAX_INCOMPATIBLE_PRINTED    16
+#define MAX_UNSTABLE_PRINTED        16
+#define MAX_READS                   255
+#define UNSTABLE_EXTENSION          ".unstable"
+#define MAX_NOTE_LENGTH             16
+#define DEFAULT_NEAREST             5
+
+#define OPT_RESUME                  0x100
+#define OPT_ADAPTIVE                0x101
+#define OPT_OVERPROGRAM             0x102
+#define OPT_LOT                     0x103
+#define OPT_REUSE                   0x104
+#define OPT_REPORT                  0x105
+#define OPT_MASK                    0x106
+#define OPT_READS                   0x107
+#define OPT_INTERVAL                0x108
+#define OPT_BASE                    0x109
+#define OPT_OFFSET                  0x10A
+#define OPT_LENGTH                  0x10B
+#define OPT_INTERLEAVE              0x10C
+#define OPT_ADDRESS_LINES           0x10D
+#define OPT_DATA_LINES              0x10E
+#define OPT_PATCH                   0x10F
+#define OPT_LIBRARY                 0x110
+#define OPT_BUILD_LIBRARY           0x111
+#define OPT_NEAREST                 0x112
+#define OPT_IDENTIFY                0x113
+#define OPT_LOCATE                  0x114
+#define OPT_TOLERANCE               0x115
+
+// Intel's "intelligent programming" algorithm over-programs by three times
+// the number of pulses it took for a location to verify
+#define DEFAULT_OVERPROGRAM         3.0f
+#define ADAPTIVE_CHECKS             16
 
 typedef enum
 {
@@ -38,9 +83,27 @@ typedef enum
     Verify,
     BlankCheck,
     Measure12V,
-    Test
+    Test,
+    CompatCheck,
+    BlankMap,
+    EraseMonitor,
+    Probe
 } operation_t;
 
+typedef enum
+{
+    VerifyReportNone,
+    VerifyReportSummary,
+    VerifyReportCsv
+} verify_report_t;
+
+typedef struct
+{
+    verify_report_t report;
+    const char *report_filename;
+    const uint8_t *care_mask;
+} verify_options_t;
+
 typedef enum
 {
     InvalidCmd,
@@ -64,17 +127,87 @@ typedef enum
 
 int _g_last_error;
 int _g_segments_printed;
-
-static bool target_read(port_handle_t port, device_type_t dev_type, const char *filename);
+volatile sig_atomic_t _g_cancel_requested;
+int _g_incompatible_printed;
+int _g_blank_ranges;
+int _g_blank_range_bytes;
+uint8_t _g_verify_erased_value;
+FILE *_g_verify_report_file;
+verify_report_t _g_verify_report;
+int _g_verify_unprogrammed_bits;
+int _g_verify_overprogrammed_bits;
+int _g_read_index;
+int _g_num_reads;
+bool _g_read_streaming;
+bool _g_read_identifying;
+int _g_nearest_size;
+
+static const struct option _g_long_options[] =
+{
+    { "resume", no_argument, NULL, OPT_RESUME },
+    { "adaptive", no_argument, NULL, OPT_ADAPTIVE },
+    { "overprogram", required_argument, NULL, OPT_OVERPROGRAM },
+    { "lot", required_argument, NULL, OPT_LOT },
+    { "reuse", no_argument, NULL, OPT_REUSE },
+    { "report", required_argument, NULL, OPT_REPORT },
+    { "mask", required_argument, NULL, OPT_MASK },
+    { "reads", required_argument, NULL, OPT_READS },
+    { "interval", required_argument, NULL, OPT_INTERVAL },
+    { "base", required_argument, NULL, OPT_BASE },
+    { "offset", required_argument, NULL, OPT_OFFSET },
+    { "length", required_argument, NULL, OPT_LENGTH },
+    { "interleave", required_argument, NULL, OPT_INTERLEAVE },
+    { "address-lines", required_argument, NULL, OPT_ADDRESS_LINES },
+    { "data-lines", required_argument, NULL, OPT_DATA_LINES },
+    { "patch", required_argument, NULL, OPT_PATCH },
+    { "library", required_argument, NULL, OPT_LIBRARY },
+    { "build-library", required_argument, NULL, OPT_BUILD_LIBRARY },
+    { "nearest", required_argument, NULL, OPT_NEAREST },
+    { "identify", required_argument, NULL, OPT_IDENTIFY },
+    { "locate", required_argument, NULL, OPT_LOCATE },
+    { "tolerance", required_argument, NULL, OPT_TOLERANCE },
+    { NULL, 0, NULL, 0 }
+};
+
+static bool parse_operations(const char *arg, operation_t *operations, int *num_operations);
+static bool target_read(port_handle_t port, device_type_t dev_type, char * const *filenames, int num_filenames, int num_reads, bool resume, int nearest);
+static void read_chunk(int bytes_read);
+static bool identify_file(const char *filename, int nearest);
+static bool print_identification(const uint8_t *data, int size, int nearest);
+static bool locate_file(const char *filename, int tolerance);
+static void print_location(const char *name, int offset, int distance);
+static void print_library_match(const char *name);
+static void print_nearest_match(const char *name, int distance);
+static bool write_unstable_map(const char *filename, const uint8_t *unstable, int size);
+static uint8_t *unscramble(uint8_t *chip, int size);
+static uint8_t *scramble(const uint8_t *board, int size);
 static bool target_blank_check(port_handle_t port, device_type_t dev_type);
-static bool target_write(port_handle_t port, device_type_t dev_type, const char *filename, int num_passes, bool blank_check, bool verify, bool hit_till_set, uint8_t parameter);
-static bool target_verify(port_handle_t port, device_type_t dev_type, const char *filename);
+static bool target_write(port_handle_t port, device_type_t dev_type, const uint8_t *image, int num_passes, bool blank_check, bool reuse, bool verify, bool hit_till_set, uint8_t parameter,
+    const char *checkpoint_filename, bool resume, bool adaptive, float overprogram, const char *lot_filename, const verify_options_t *verify_options);
+static bool target_compat_check(port_handle_t port, device_type_t dev_type, const uint8_t *image);
+static bool target_blank_map(port_handle_t port, device_type_t dev_type);
+static bool target_erase_monitor(port_handle_t port, device_type_t dev_type, int interval);
+static bool target_verify(port_handle_t port, device_type_t dev_type, const uint8_t *image, const verify_options_t *verify_options);
 static bool target_measure_12v(port_handle_t port, device_type_t dev_type);
+static bool target_probe(port_handle_t port);
+static bool work_probe(port_handle_t port, bool blank_check, device_type_t *detected);
+static void print_device_list(const char *heading, const device_type_t *types, int count);
 static bool work_blank_check(port_handle_t port, device_type_t dev_type, bool *blank);
-static bool work_verify(port_handle_t port, device_type_t dev_type, const char *filename, bool *matches);
+static bool work_compat_check(port_handle_t port, device_type_t dev_type, const uint8_t *image, bool *compatible);
+static void print_incompatible(int offset, uint8_t device, uint8_t image);
+static bool work_blank_map(port_handle_t port, device_type_t dev_type, bool print_ranges, int *programmed_bits);
+static void print_blank_range(int offset, int length);
+static bool work_verify(port_handle_t port, device_type_t dev_type, const uint8_t *image, const verify_options_t *verify_options, bool *matches);
+static bool work_verify_full(port_handle_t port, device_type_t dev_type, const uint8_t *image, const verify_options_t *verify_options, bool *matches);
+static void print_mismatch(int offset, uint8_t image, uint8_t device, uint8_t care);
+static bool work_adaptive_check(port_handle_t port, device_type_t dev_type, const uint8_t *image, bool *matches);
+static int adaptive_total_passes(int verified_pass, float overprogram, int num_passes);
+static bool work_record_lot(port_handle_t port, device_type_t dev_type, const write_result_t *write_result, const char *lot_filename, tuning_record_t *record);
 static bool target_test(port_handle_t port, shield_type_t shield_type);
 static void print_progress(int pct);
+static void print_read_progress(int pct);
 static void print_passes(int pass, int num_passes);
+static void print_progress_note(const char *note);
 static void print_progress_outline(void);
 static void print_line_prefix(void);
 static void print_target_error(bool cli_mode);
@@ -86,15 +219,48 @@ int main(int argc, char *argv[])
     bool operation_result = false;
     bool hit_until_set = true;
     bool blank_check = false;
+    bool reuse = false;
     bool verify = false;
     bool slow = false;
+    bool resume = false;
+    bool adaptive = false;
+    bool auto_retries = false;
+    bool auto_device = false;
+    float overprogram = DEFAULT_OVERPROGRAM;
+    verify_options_t verify_options;
+    image_select_t image_select;
     int opt = 0;
     int baud = 38400;
     int num_passes = 0;
+    int num_reads = 1;
+    int interval = 0;
+    uint32_t base_address = 0;
     int parameter = 0;
+    int num_operations = 0;
+    int num_filenames = 0;
+    bool needs_image = false;
+    bool needs_output = false;
     char port_name[32];
-    char *filename = NULL;
-    operation_t operation = None;
+    char *filenames[MAX_FILES];
+    const char *image_filename = NULL;
+    char **output_filenames = NULL;
+    int num_output_filenames = 0;
+    int num_stdout_filenames = 0;
+    char *checkpoint_filename = NULL;
+    char *lot_filename = NULL;
+    char *mask_spec = NULL;
+    char *address_lines = NULL;
+    char *data_lines = NULL;
+    char *patch_spec = NULL;
+    char *library_filename = NULL;
+    char *library_directory = NULL;
+    char *identify_filename = NULL;
+    char *locate_filename = NULL;
+    int nearest = DEFAULT_NEAREST;
+    int tolerance = -1;
+    const uint8_t *image = NULL;
+    uint8_t *care_mask = NULL;
+    operation_t operations[MAX_OPERATIONS];
     device_type_t dev_type = NotSet;
     shield_type_t shield_type = SHIELD_TYPE_UNKNOWN;
     port_handle_t port = DEFAULT_PORT_HANDLE;
@@ -107,63 +273,35 @@ int main(int argc, char *argv[])
     }
 
     terminal_setup();
+    catch_sigterm();
 
     _g_last_error = PGM_ERR_OK;
 
     memset(port_name, 0, sizeof(port_name));
+    memset(&verify_options, 0, sizeof(verify_options));
+    memset(&image_select, 0, sizeof(image_select));
+    image_select.interleave = 1;
 
-    while ((opt = getopt(argc, argv, "o:p:u:d:f:n:r:s:mbv?")) != -1)
+    while ((opt = getopt_long(argc, argv, "o:p:u:d:f:n:r:s:mbv?", _g_long_options, NULL)) != -1)
     {
         switch (opt)
         {
             case 'o':
             {
-                if (!_stricmp(optarg, "read"))
-                    operation = Read;
-                else if (!_stricmp(optarg, "write"))
-                    operation = Write;
-                else if (!_stricmp(optarg, "verify"))
-                    operation = Verify;
-                else if (!_stricmp(optarg, "blankcheck"))
-                    operation = BlankCheck;
-                else if (!_stricmp(optarg, "measure12v"))
-                    operation = Measure12V;
-                else if (!_stricmp(optarg, "test"))
-                    operation = Test;
+                if (!parse_operations(optarg, operations, &num_operations))
+                {
+                    fprintf(stderr, "\r\nInvalid operation list.\r\n");
+                    operation_result = false;
+                    goto out;
+                }
                 break;
             }
             case 'd':
             {
-                if (!_stricmp(optarg, "1702A"))
-                    dev_type = C1702A;
-                else if (!_stricmp(optarg, "2704"))
-                    dev_type = C2704;
-                else if (!_stricmp(optarg, "2708"))
-                    dev_type = C2708;
-                else if (!_stricmp(optarg, "TMS2716"))
-                    dev_type = TMS2716;
-                else if (!_stricmp(optarg, "MCM6876X"))
-                    dev_type = MCM6876X;
-                else if (!_stricmp(optarg, "8741"))
-                    dev_type = D8741;
-                else if (!_stricmp(optarg, "8742"))
-                    dev_type = D8742;
-                else if (!_stricmp(optarg, "8748"))
-                    dev_type = D8748;
-                else if (!_stricmp(optarg, "8749"))
-                    dev_type = D8749;
-                else if (!_stricmp(optarg, "8048"))
-                    dev_type = P8048;
-                else if (!_stricmp(optarg, "8049"))
-                    dev_type = P8049;
-                else if (!_stricmp(optarg, "8050"))
-                    dev_type = P8050;
-                else if (!_stricmp(optarg, "8755"))
-                    dev_type = D8755;
-                else if (!_stricmp(optarg, "8041"))
-                    dev_type = P8041;
-                else if (!_stricmp(optarg, "8042"))
-                    dev_type = P8042;
+                if (!_stricmp(optarg, "auto"))
+                    auto_device = true;
+                else
+                    dev_type = device_find(optarg);
                 break;
             }
             case 's':
@@ -197,7 +335,13 @@ int main(int argc, char *argv[])
             }
             case 'f':
             {
-                filename = _strdup(optarg);
+                if (num_filenames == MAX_FILES)
+                {
+                    fprintf(stderr, "\r\nToo many files specified.\r\n");
+                    operation_result = false;
+                    goto out;
+                }
+                filenames[num_filenames++] = _strdup(optarg);
                 break;
             }
             case 'n':
@@ -207,7 +351,10 @@ int main(int argc, char *argv[])
             }
             case 'r':
             {
-                parameter = atoi(optarg);
+                if (!_stricmp(optarg, "auto"))
+                    auto_retries = true;
+                else
+                    parameter = atoi(optarg);
                 break;
             }
             case 'm':
@@ -225,6 +372,155 @@ int main(int argc, char *argv[])
                 verify = true;
                 break;
             }
+            case OPT_RESUME:
+            {
+                resume = true;
+                break;
+            }
+            case OPT_ADAPTIVE:
+            {
+                adaptive = true;
+                break;
+            }
+            case OPT_OVERPROGRAM:
+            {
+                overprogram = (float)atof(optarg);
+                break;
+            }
+            case OPT_LOT:
+            {
+                lot_filename = _strdup(optarg);
+                break;
+            }
+            case OPT_REUSE:
+            {
+                reuse = true;
+                break;
+            }
+            case OPT_READS:
+            {
+                num_reads = atoi(optarg);
+                if (num_reads < 1 || num_reads > MAX_READS)
+                {
+                    fprintf(stderr, "\r\nNumber of reads must be between 1 and %d.\r\n", MAX_READS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case OPT_INTERVAL:
+            {
+                interval = atoi(optarg);
+                if (interval < 0)
+                    interval = 0;
+                break;
+            }
+            case OPT_BASE:
+            {
+                base_address = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            }
+            case OPT_OFFSET:
+            {
+                image_select.offset = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            }
+            case OPT_LENGTH:
+            {
+                image_select.length = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            }
+            case OPT_INTERLEAVE:
+            {
+                char *lane;
+                char *end;
+
+                image_select.interleave = (int)strtol(optarg, &lane, 0);
+                image_select.lane = 0;
+                end = lane;
+
+                if (*lane == ':')
+                    image_select.lane = (int)strtol(lane + 1, &end, 0);
+
+                if (lane == optarg || (*lane == ':' && end == lane + 1) || *end ||
+                    image_select.interleave < 1 || image_select.lane < 0 || image_select.lane >= image_select.interleave)
+                {
+                    fprintf(stderr, "\r\nInterleave must be WIDTH:LANE with LANE less than WIDTH.\r\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case OPT_ADDRESS_LINES:
+            {
+                address_lines = _strdup(optarg);
+                break;
+            }
+            case OPT_DATA_LINES:
+            {
+                data_lines = _strdup(optarg);
+                break;
+            }
+            case OPT_PATCH:
+            {
+                patch_spec = _strdup(optarg);
+                break;
+            }
+            case OPT_LIBRARY:
+            {
+                library_filename = _strdup(optarg);
+                break;
+            }
+            case OPT_BUILD_LIBRARY:
+            {
+                library_directory = _strdup(optarg);
+                break;
+            }
+            case OPT_NEAREST:
+            {
+                nearest = atoi(optarg);
+                break;
+            }
+            case OPT_IDENTIFY:
+            {
+                identify_filename = _strdup(optarg);
+                break;
+            }
+            case OPT_LOCATE:
+            {
+                locate_filename = _strdup(optarg);
+                break;
+            }
+            case OPT_TOLERANCE:
+            {
+                tolerance = atoi(optarg);
+                break;
+            }
+            case OPT_MASK:
+            {
+                mask_spec = _strdup(optarg);
+                break;
+            }
+            case OPT_REPORT:
+            {
+                if (!_stricmp(optarg, "summary"))
+                {
+                    verify_options.report = VerifyReportSummary;
+                }
+                else if (!_stricmp(optarg, "csv"))
+                {
+                    verify_options.report = VerifyReportCsv;
+                }
+                else if (!strncmp(optarg, "csv:", 4) || !strncmp(optarg, "CSV:", 4))
+                {
+                    verify_options.report = VerifyReportCsv;
+                    verify_options.report_filename = optarg + 4;
+                }
+                else
+                {
+                    help(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
             default:
             {
                 help(argv[0]);
@@ -233,6 +529,36 @@ int main(int argc, char *argv[])
         }
     }
 
+    // Indexing a library doesn't involve the programmer
+    if (library_directory)
+    {
+        if (!library_filename)
+        {
+            fprintf(stderr, "\r\nNo library file specified (--library).\r\n");
+            operation_result = false;
+            goto out;
+        }
+
+        operation_result = library_build(library_directory, library_filename);
+        goto out;
+    }
+
+    if (identify_filename || locate_filename)
+    {
+        if (!library_filename)
+        {
+            fprintf(stderr, "\r\nNo library file specified (--library).\r\n");
+            operation_result = false;
+            goto out;
+        }
+
+        if (identify_filename)
+            operation_result = library_open(library_filename) && identify_file(identify_filename, nearest);
+        else
+            operation_result = library_open(library_filename) && locate_file(locate_filename, tolerance);
+        goto out;
+    }
+
     if (baud != 9600 && baud != 38400 && baud != 115200)
     {
         fprintf(stderr, "\r\nInvalid baud rate. Must be 9600, 38400 or 115200\r\n");
@@ -256,16 +582,77 @@ int main(int argc, char *argv[])
     }
 #endif
 
-    if (operation == Read || operation == Write || operation == Verify)
+    if (num_operations == 0)
+    {
+        fprintf(stderr, "\r\nNo operation specified.\r\n");
+        operation_result = false;
+        goto out;
+    }
+
+    for (int i = 0; i < num_operations; i++)
     {
-        if (!filename)
+        if (operations[i] == Write || operations[i] == Verify || operations[i] == CompatCheck)
+            needs_image = true;
+        else if (operations[i] == Read)
+            needs_output = true;
+        else if ((operations[i] == Test || operations[i] == Probe) && num_operations > 1)
         {
-            fprintf(stderr, "\r\nNo filename specified.\r\n");
+            fprintf(stderr, "\r\nThe %s operation cannot be combined with other operations.\r\n", operations[i] == Test ? "test" : "probe");
             operation_result = false;
             goto out;
         }
     }
 
+    // With both an input image and a read in the same session, the first
+    // file is the image and the rest receive the read
+    if (needs_image && num_filenames > 0)
+        image_filename = filenames[0];
+
+    if (needs_output && num_filenames > (needs_image ? 1 : 0))
+    {
+        output_filenames = filenames + (needs_image ? 1 : 0);
+        num_output_filenames = num_filenames - (needs_image ? 1 : 0);
+    }
+
+    if ((needs_image && !image_filename) || (needs_output && !num_output_filenames))
+    {
+        fprintf(stderr, "\r\nNo filename specified.\r\n");
+        operation_result = false;
+        goto out;
+    }
+
+    if (num_output_filenames > DUMP_MAX_OUTPUTS)
+    {
+        fprintf(stderr, "\r\nA read can go to at most %d files.\r\n", DUMP_MAX_OUTPUTS);
+        operation_result = false;
+        goto out;
+    }
+
+    for (int i = 0; i < num_output_filenames; i++)
+    {
+        if (!strcmp(output_filenames[i], STDIO_FILENAME))
+            num_stdout_filenames++;
+    }
+
+    // A CSV report without a file goes to stdout in the same way
+    if (verify_options.report == VerifyReportCsv && !verify_options.report_filename)
+        num_stdout_filenames++;
+
+    if (num_stdout_filenames > 1)
+    {
+        fprintf(stderr, "\r\nOnly one output can go to stdout.\r\n");
+        operation_result = false;
+        goto out;
+    }
+
+    // Must happen before anything else is printed, so none of it lands in the
+    // dump or the report
+    if (num_stdout_filenames && !dump_claim_stdout())
+    {
+        operation_result = false;
+        goto out;
+    }
+
     if (!serial_open(port_name, baud, &port))
     {
 #ifdef _WIN32
@@ -277,193 +664,794 @@ int main(int argc, char *argv[])
         goto out;
     }
     
-    if (operation == Test)
+    if (operations[0] == Probe)
     {
-        if (shield_type == SHIELD_TYPE_UNKNOWN)
+        operation_result = target_probe(port);
+        goto out;
+    }
+
+    // The supply is checked again below against the detected device's limits
+    if (auto_device)
+    {
+        if (!target_measure_12v(port, NotSet) || !work_probe(port, false, &dev_type))
         {
-            fprintf(stderr, "\r\nNo shield type specified.\r\n");
             operation_result = false;
             goto out;
         }
-    }
-    else
-    {
-        switch (dev_type)
+
+        if (dev_type == NotSet)
         {
-            case C1702A:
-            {
-                if (!num_passes)
-                    num_passes = 32;
-                hit_until_set = false;
-                break;
-            }
-            case C2704:
-            case C2708:
-            case TMS2716:
-            {
-                if (!num_passes)
-                    num_passes = 100;
-                hit_until_set = false;
-                break;
-            }
-            case D8741:
-            case D8742:
-            case D8748:
-            case D8749:
-            case P8048:
-            case P8049:
-            case P8050:
-            case D8755:
-            {
-                if (!num_passes)
-                    num_passes = 1;
-                parameter = 0;
-                break;
-            }
-            case MCM6876X:
-            {
-                if (!num_passes)
-                    num_passes = 1;
-                if (!parameter)
-                    parameter = 5;
-                break;
-            }
-            default:
-            {
-                fprintf(stderr, "\r\nInvalid or no device type specified.\r\n");
-                operation_result = false;
-                goto out;
-            }
+            fprintf(stderr, "\r\n'-d auto' could not pick a single device type.\r\n");
+            operation_result = false;
+            goto out;
         }
     }
 
-    switch (operation)
+    if (operations[0] == Test)
     {
-        case Read:
-            operation_result = target_read(port, dev_type, filename);
-            break;
-        case BlankCheck:
-            operation_result = target_blank_check(port, dev_type);
-            break;
-        case Verify:
-            operation_result = target_verify(port, dev_type, filename);
-            break;
-        case Write:
-            operation_result = target_write(port, dev_type, filename, num_passes, blank_check, verify, hit_until_set, parameter);
-            break;
-        case Measure12V:
-            operation_result = target_measure_12v(port, dev_type);
-            break;
-        case Test:
-            operation_result = target_test(port, shield_type);
-            break;
-        default:
-            fprintf(stderr, "\r\nNo operation specified.\r\n");
+        if (shield_type == SHIELD_TYPE_UNKNOWN)
+        {
+            fprintf(stderr, "\r\nNo shield type specified.\r\n");
             operation_result = false;
             goto out;
+        }
     }
+    else
+    {
+        const device_t *device = device_get(dev_type);
 
-out:
-    serial_close(port);
-
-    if (filename)
-        free(filename);
-
-#ifndef _WIN32
-    printf("\r\n");
-#endif
+        if (!device)
+        {
+            fprintf(stderr, "\r\nInvalid or no device type specified.\r\n");
+            operation_result = false;
+            goto out;
+        }
 
-    if (!operation_result)
-        return EXIT_FAILURE;
+        if (!num_passes)
+            num_passes = device->default_passes;
 
-    return EXIT_SUCCESS;
-}
+        if (device->capabilities & DEVICE_CAP_FIXED_PASSES)
+            hit_until_set = false;
 
-static void help(const char *progname)
-{
-    fprintf(stderr, "\r\nUsage: %s -o operation [options]\r\n\r\n"
-        "Read device to file:\r\n\r\n"
-        "\t%s -o read -p PORT -d DEVICE -f FILE\r\n\r\n"
-#ifdef _WIN32
-        "\tPORT must be in the format COMxx\r\n"
-#else
-        "\tPORT must be in the format /dev/ttyXXX\r\n\r\n"
-#endif
-        "\tDEVICE must be one of 1702A/2704/2708/TMS2716/MCM6876X/8748/8749/8741/8742/8048/8049/8050/8755/8041/8042\r\n\r\n"
-        "Blank check device:\r\n\r\n"
-        "\t%s -o blankcheck -p PORT -d DEVICE\r\n\r\n"
-        "Write device from file:\r\n\r\n"
-        "\t%s -o write -p PORT -d DEVICE -f FILE [-b] [-v] [-r REWRITES] [-m] [-n PASSES] [-s]\r\n\r\n"
-        "\tPass '-b' to blank check before write. Pass '-v' to verify device after write.\r\n\r\n"
-        "\tFor MCM68676x each byte is written until it matches the desired value, then written\r\n"
-        "\ta further REWRITES (-r) times. This defaults to %u if REWRITES is not specified.\r\n\r\n"
-        "\tAlso for MCM68676x '-m' can be optionally passed to force the programmer\r\n"
-        "\tto the simpler 'fixed passes' mode for older versions of the chip.\r\n\r\n"
-        "\tFor MCS48 '-m' can be optionally passed to stop the programmer from verifying\r\n"
-        "\tand retrying writes inline.\r\n\r\n"
-        "\tFor all device types use '-n' to specify the number of passes.\r\n"
-        "\tManufacturer recommended defaults are used if this option is not specified.\r\n\r\n"
-        "Verify device against file:\r\n\r\n"
-        "\t%s -o verify -p PORT -d DEVICE -f FILE [-b]\r\n\r\n"        
-        "Start the hardware test for the shield of a given device type:\r\n\r\n"
-        "\t%s -o test -p PORT -s SHIELD_TYPE\r\n"
-        "\tSHIELD_TYPE must be one of 1702A/270Xv1/270Xv2/MCM6876Xv1/MCM6876Xv2/MCS48\r\n\r\n",
-        progname, progname, progname, progname, MCM6876X_DEFAULT_RETRIES, progname, progname);
-}
+        if (device->capabilities & DEVICE_CAP_REWRITES)
+        {
+            if (auto_retries && hit_until_set)
+            {
+                tuning_history_t history;
 
-static bool target_read(port_handle_t port, device_type_t dev_type, const char *filename)
-{
-    bool success = false;
-    uint8_t *read_buffer = NULL;
-    FILE *output_file;
-    int dev_size = pgm_get_dev_size(dev_type);
+                if (!lot_filename)
+                {
+                    fprintf(stderr, "\r\n'-r auto' requires a lot history file (--lot).\r\n");
+                    operation_result = false;
+                    goto out;
+                }
 
-    if (!target_measure_12v(port, dev_type))
-        return false;
+                tuning_load(lot_filename, &history);
+                parameter = tuning_recommend_retries(&history, MCM6876X_DEFAULT_RETRIES);
 
-    printf("Reading device...\r\n\r\n");
+                printf("\r\nUsing %d rewrites. Lot history: %d chips (%d with a per-byte map), slowest byte set after %d writes.\r\n",
+                    parameter, history.num_chips, history.num_mapped, history.max_writes);
+            }
+            if (!parameter)
+                parameter = MCM6876X_DEFAULT_RETRIES;
+        }
+        else if (!(device->capabilities & DEVICE_CAP_FIXED_PASSES))
+        {
+            parameter = 0;
+        }
+    }
 
-    read_buffer = malloc(dev_size);
+    if (operations[0] == Test)
+    {
+        operation_result = target_test(port, shield_type);
+        goto out;
+    }
 
-    print_progress_outline();
+    // Everything below shares one session: the port, the supply check
+    // and the image are set up once for the whole operation list
 
-    if (!pgm_read(port, dev_type, read_buffer, NULL, &print_progress, NULL))
+    if (!transform_setup(address_lines, data_lines, pgm_get_dev_size(dev_type)))
     {
-        print_target_error(true);
-        success = false;
+        operation_result = false;
         goto out;
     }
 
-    printf("\r\n\r\nRead successful.\r\n");
+    if (needs_output && library_filename && !library_open(library_filename))
+    {
+        operation_result = false;
+        goto out;
+    }
+
+    if (needs_image && !image_load(image_filename, dev_type, base_address, &image_select, &image))
+    {
+        operation_result = false;
+        goto out;
+    }
+
+    if (needs_image && mask_spec)
+    {
+        if (!image_load_mask(mask_spec, dev_type, &care_mask))
+        {
+            operation_result = false;
+            goto out;
+        }
+
+        verify_options.care_mask = care_mask;
+    }
+
+    if (image && patch_spec)
+    {
+        checksum_patch_t patch;
+        uint8_t *patched_image;
+        uint32_t value;
+        int dev_size = pgm_get_dev_size(dev_type);
+
+        if (!checksum_parse_patch(patch_spec, dev_size, &patch))
+        {
+            operation_result = false;
+            goto out;
+        }
+
+        patched_image = malloc(dev_size);
+        memcpy(patched_image, image, dev_size);
+        value = checksum_apply_patch(patched_image, &patch);
+
+        printf("\r\nChecksum 0x%0*X stored at 0x%04X.\r\n", patch.width * 2, value, patch.address);
+
+        image_free(image);
+        image = patched_image;
+    }
+
+    // Images and masks are in board order; the device is programmed and
+    // compared in chip order
+    if (transform_active() && image)
+    {
+        const uint8_t *board_image = image;
+
+        image = scramble(board_image, pgm_get_dev_size(dev_type));
+        image_free(board_image);
+
+        if (care_mask)
+        {
+            uint8_t *board_mask = care_mask;
+
+            care_mask = scramble(board_mask, pgm_get_dev_size(dev_type));
+            image_free(board_mask);
+            verify_options.care_mask = care_mask;
+        }
+    }
+
+    // An image from stdin has no name to key a checkpoint on
+    if (needs_image && strcmp(image_filename, STDIO_FILENAME))
+    {
+        checkpoint_filename = malloc(strlen(image_filename) + sizeof(CHECKPOINT_EXTENSION));
+        strcpy(checkpoint_filename, image_filename);
+        strcat(checkpoint_filename, CHECKPOINT_EXTENSION);
+    }
+
+    if (!target_measure_12v(port, dev_type))
+    {
+        operation_result = false;
+        goto out;
+    }
+
+    for (int i = 0; i < num_operations; i++)
+    {
+        switch (operations[i])
+        {
+            case Read:
+                operation_result = target_read(port, dev_type, output_filenames, num_output_filenames, num_reads, resume, nearest);
+                break;
+            case BlankCheck:
+                operation_result = target_blank_check(port, dev_type);
+                break;
+            case Verify:
+                operation_result = target_verify(port, dev_type, image, &verify_options);
+                break;
+            case Write:
+                operation_result = target_write(port, dev_type, image, num_passes, blank_check, reuse, verify, hit_until_set, parameter, checkpoint_filename, resume, adaptive, overprogram, lot_filename, &verify_options);
+                break;
+            case CompatCheck:
+                operation_result = target_compat_check(port, dev_type, image);
+                break;
+            case BlankMap:
+                operation_result = target_blank_map(port, dev_type);
+                break;
+            case EraseMonitor:
+                operation_result = target_erase_monitor(port, dev_type, interval);
+                break;
+            case Measure12V:
+                operation_result = true;
+                break;
+            default:
+                operation_result = false;
+                break;
+        }
+
+        if (!operation_result)
+            break;
+    }
+
+out:
+    serial_close(port);
+
+    image_free(image);
+    image_free(care_mask);
+
+    if (checkpoint_filename)
+        free(checkpoint_filename);
+
+    if (lot_filename)
+        free(lot_filename);
+
+    if (mask_spec)
+        free(mask_spec);
+
+    if (address_lines)
+        free(address_lines);
+
+    if (data_lines)
+        free(data_lines);
+
+    if (patch_spec)
+        free(patch_spec);
+
+    if (library_filename)
+        free(library_filename);
+
+    if (library_directory)
+        free(library_directory);
+
+    if (identify_filename)
+        free(identify_filename);
+
+    if (locate_filename)
+        free(locate_filename);
+
+    transform_free();
+    library_close();
+
+    for (int i = 0; i < num_filenames; i++)
+        free(filenames[i]);
+
+#ifndef _WIN32
+    printf("\r\n");
+#endif
+
+    if (!operation_result)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
 
+static void help(const char *progname)
+{
+    fprintf(stderr, "\r\nUsage: %s -o operation[,operation...] [options]\r\n\r\n"
+        "Read device to file:\r\n\r\n"
+        "\t%s -o read -p PORT -d DEVICE -f FILE [-f FILE...] [--reads N]\r\n\r\n"
+        "\tEach FILE is written as raw binary, Intel HEX (.hex/.ihx/.mcs) or S-record\r\n"
+        "\t(.s19/.s28/.s37/.srec/.mot) according to its extension, all from the same read.\r\n"
+        "\tThe read's Sum8, CRC16, CRC32, MD5 and SHA-1 are printed.\r\n\r\n"
+        "\tPass '--reads N' to read the device N times and save the majority value of each bit.\r\n"
+        "\tBits which did not read the same every time are saved to FILE" UNSTABLE_EXTENSION ", in the\r\n"
+        "\tformat taken by '--mask'. FILE is the first '-f' that isn't '-'.\r\n\r\n"
+        "\tThe read is saved to FILE" DUMP_PART_EXTENSION " as it arrives and renamed to FILE when complete,\r\n"
+        "\talong with its CRC32 in FILE" DUMP_SFV_EXTENSION ". Pass '--resume' to continue a partial read.\r\n\r\n"
+        "\tA FILE of '-' writes the read to stdout as raw binary. Messages then go to stderr.\r\n\r\n"
+        "\tPass '--library LIBRARY' to identify the device against a library of known ROMs.\r\n"
+        "\tThe ROM is named next to the progress bar as soon as no other fits the read so far.\r\n"
+        "\tIf none matches exactly, the closest ROMs by number of differing bits are listed,\r\n"
+        "\tup to '--nearest N' (default %d).\r\n\r\n"
 #ifdef _WIN32
-    if (fopen_s(&output_file, filename, "wb"))
+        "\tPORT must be in the format COMxx\r\n"
 #else
-    if (!(output_file = fopen(filename, "wb")))
-#endif /* _WIN32 */
+        "\tPORT must be in the format /dev/ttyXXX\r\n\r\n"
+#endif
+        "\tDEVICE must be one of %s, or 'auto' to detect it as for '-o probe'.\r\n\r\n"
+        "Build a library of known ROMs from every file under DIRECTORY:\r\n\r\n"
+        "\t%s --build-library DIRECTORY --library LIBRARY\r\n\r\n"
+        "Identify a dump against a library:\r\n\r\n"
+        "\t%s --identify FILE --library LIBRARY [--nearest N]\r\n\r\n"
+        "Find where a dump sits inside the larger images of a library:\r\n\r\n"
+        "\t%s --locate FILE --library LIBRARY [--tolerance BITS]\r\n\r\n"
+        "\tEvery place the dump appears with no more than BITS wrong (default 1%% of its\r\n"
+        "\tbits) is listed.\r\n\r\n"
+        "Detect which device types the attached shield and switch accept:\r\n\r\n"
+        "\t%s -o probe -p PORT\r\n\r\n"
+        "\tTypes needing the selection switch moved are listed separately. If the shield\r\n"
+        "\taccepts several types, the device is blank checked as each UV erasable one and\r\n"
+        "\tthe results listed, but the type must then be given with '-d'. '-d auto' only\r\n"
+        "\tproceeds when the shield accepts a single type.\r\n\r\n"
+        "Blank check device:\r\n\r\n"
+        "\t%s -o blankcheck -p PORT -d DEVICE\r\n\r\n"
+        "\tUse '-o blankmap' instead to read the whole device and list every non-blank\r\n"
+        "\trange with the number of bits still programmed.\r\n\r\n"
+        "Monitor a device in the UV eraser until it is blank:\r\n\r\n"
+        "\t%s -o erasemonitor -p PORT -d DEVICE [--interval SECONDS]\r\n\r\n"
+        "\tThe device is mapped repeatedly, SECONDS apart (default back to back), and the\r\n"
+        "\tnumber of bits still programmed is logged each time it changes.\r\n\r\n"
+        "Write device from file:\r\n\r\n"
+        "\t%s -o write -p PORT -d DEVICE -f FILE [-b] [-v] [-r REWRITES] [-m] [-n PASSES] [-s]\r\n\r\n"
+        "\tPass '-b' to blank check before write. Pass '-v' to verify device after write.\r\n\r\n"
+        "\tFILE may be raw binary, Intel HEX (.hex/.ihx/.mcs) or S-record (.s19/.s28/.s37/.srec/.mot).\r\n"
+        "\tFor HEX and S-record pass '--base ADDR' if the device does not start at address 0.\r\n"
+        "\tA FILE of '-' reads a raw binary image from stdin.\r\n\r\n"
+        "\tTo take one chip of a multi-chip set from a larger FILE, pass '--offset BYTES' and\r\n"
+        "\t'--length BYTES' to select its bank, and '--interleave WIDTH:LANE' to take every\r\n"
+        "\tWIDTH'th byte starting at LANE, e.g. '--interleave 2:0' for the even bytes of a\r\n"
+        "\t16-bit image. These also apply to verify.\r\n\r\n"
+        "\tIf the board wires the device's lines out of order, pass '--address-lines LIST' and/or\r\n"
+        "\t'--data-lines LIST', giving the board line wired to each device line from 0 upwards,\r\n"
+        "\te.g. '--data-lines 7,6,5,4,3,2,1,0'. FILE is then in board order for write, verify\r\n"
+        "\tand read.\r\n\r\n"
+        "\tPass '--patch TYPE@ADDR[:START-END]' to store a checksum of the image (default all of it)\r\n"
+        "\tat ADDR before writing. TYPE is sum8, sum8c (makes the range sum to zero), crc16\r\n"
+        "\t(CCITT-FALSE) or crc32, with 'le' after the CRCs to store them little endian.\r\n\r\n"
+        "\tWith '-b', pass '--reuse' to also accept a used device which can be taken to the\r\n"
+        "\timage by programming further bits only, without erasing it first.\r\n\r\n"
+        "\tFor MCM68676x each byte is written until it matches the desired value, then written\r\n"
+        "\ta further REWRITES (-r) times. This defaults to %u if REWRITES is not specified.\r\n\r\n"
+        "\tPass '--lot FILE' to keep a history of how many writes each byte needed to set\r\n"
+        "\tacross a chip lot, and '-r auto' to use the smallest margin that history supports:\r\n"
+        "\t%d times the writes %.1f%% of bytes needed to set, and at least %d. This needs the\r\n"
+        "\tper-byte write map from at least %d chips, which only firmware with the write map\r\n"
+        "\tcommand provides. Until then the default is used.\r\n\r\n"
+        "\tAlso for MCM68676x '-m' can be optionally passed to force the programmer\r\n"
+        "\tto the simpler 'fixed passes' mode for older versions of the chip.\r\n\r\n"
+        "\tFor MCS48 '-m' can be optionally passed to stop the programmer from verifying\r\n"
+        "\tand retrying writes inline.\r\n\r\n"
+        "\tFor all device types use '-n' to specify the number of passes.\r\n"
+        "\tManufacturer recommended defaults are used if this option is not specified.\r\n\r\n"
+        "\tProgress is recorded in FILE.ckpt while writing. If a write is interrupted, run\r\n"
+        "\tthe same command again with '--resume' to continue. The interrupted pass carries\r\n"
+        "\ton from its last acknowledged chunk and the remaining passes are written in full.\r\n"
+        "\tA write of an image from stdin keeps no checkpoint and cannot be resumed.\r\n\r\n"
+        "\tFor 1702A/2704/2708/TMS2716 pass '--adaptive' to read the device back between\r\n"
+        "\tgroups of passes. Once it verifies after P passes, a further P * MULTIPLIER\r\n"
+        "\tpasses are written and the write stops. '--overprogram MULTIPLIER' defaults\r\n"
+        "\tto %.0f. The total never exceeds the number of passes given by '-n'.\r\n\r\n"
+        "Check whether a used device can be programmed with file without erasing it:\r\n\r\n"
+        "\t%s -o compatcheck -p PORT -d DEVICE -f FILE\r\n\r\n"
+        "Verify device against file:\r\n\r\n"
+        "\t%s -o verify -p PORT -d DEVICE -f FILE [-b] [--report FORMAT]\r\n\r\n"
+        "\tVerify normally stops at the first difference. '--report summary' reads the whole\r\n"
+        "\tdevice and lists every difference with the bits which are wrong. '--report csv'\r\n"
+        "\twrites the same as CSV, to stdout or with 'csv:FILE' to FILE. Also applies to '-v'.\r\n"
+        "\tWith the CSV on stdout, messages go to stderr.\r\n\r\n"
+        "\tPass '--mask MASK' to ignore bytes which differ per chip (serial numbers, calibration).\r\n"
+        "\tMASK is a binary file where set bits are don't-care, or a list of address ranges\r\n"
+        "\tSTART[-END][:BITS] e.g. '0x3F0-0x3FF,0x100:0x0F'. BITS limits the range to those bits.\r\n\r\n"
+        "Start the hardware test for the shield of a given device type:\r\n\r\n"
+        "\t%s -o test -p PORT -s SHIELD_TYPE\r\n"
+        "\tSHIELD_TYPE must be one of 1702A/270Xv1/270Xv2/MCM6876Xv1/MCM6876Xv2/MCS48\r\n\r\n"
+        "Run several operations in one session:\r\n\r\n"
+        "\t%s -o blankcheck,write,verify,read -p PORT -d DEVICE -f FILE -f BACKUP\r\n\r\n"
+        "\tOperations run in the order given, sharing one port, one supply check and one\r\n"
+        "\tcopy of the image. When the list both uses an image (write/verify) and reads,\r\n"
+        "\tthe first '-f' is the image and the rest receive the read.\r\n\r\n",
+        progname, progname, DEFAULT_NEAREST, device_names(), progname, progname, progname, progname, progname, progname, progname, MCM6876X_DEFAULT_RETRIES, TUNING_MARGIN_FACTOR, TUNING_PERCENTILE / 10.0, TUNING_MIN_RETRIES, TUNING_MIN_CHIPS, DEFAULT_OVERPROGRAM, progname, progname, progname, progname);
+}
+
+static bool parse_operations(const char *arg, operation_t *operations, int *num_operations)
+{
+    char name[16];
+
+    *num_operations = 0;
+
+    while (*arg)
+    {
+        const char *end = strchr(arg, ',');
+        size_t len = end ? (size_t)(end - arg) : strlen(arg);
+
+        if (len == 0 || len >= sizeof(name) || *num_operations == MAX_OPERATIONS)
+            return false;
+
+        memcpy(name, arg, len);
+        name[len] = 0;
+
+        if (!_stricmp(name, "read"))
+            operations[*num_operations] = Read;
+        else if (!_stricmp(name, "write"))
+            operations[*num_operations] = Write;
+        else if (!_stricmp(name, "verify"))
+            operations[*num_operations] = Verify;
+        else if (!_stricmp(name, "blankcheck"))
+            operations[*num_operations] = BlankCheck;
+        else if (!_stricmp(name, "measure12v"))
+            operations[*num_operations] = Measure12V;
+        else if (!_stricmp(name, "test"))
+            operations[*num_operations] = Test;
+        else if (!_stricmp(name, "compatcheck"))
+            operations[*num_operations] = CompatCheck;
+        else if (!_stricmp(name, "blankmap"))
+            operations[*num_operations] = BlankMap;
+        else if (!_stricmp(name, "erasemonitor"))
+            operations[*num_operations] = EraseMonitor;
+        else if (!_stricmp(name, "probe"))
+            operations[*num_operations] = Probe;
+        else
+            return false;
+
+        (*num_operations)++;
+        arg += len;
+
+        if (*arg == ',')
+            arg++;
+    }
+
+    return *num_operations > 0;
+}
+
+static bool target_read(port_handle_t port, device_type_t dev_type, char * const *filenames, int num_filenames, int num_reads, bool resume, int nearest)
+{
+    bool success = false;
+    bool streaming = (num_reads == 1 && !transform_active());
+    bool dump_open = false;
+    uint8_t *read_buffer = NULL;
+    uint8_t *unstable = NULL;
+    uint16_t *votes = NULL;
+    int dev_size = pgm_get_dev_size(dev_type);
+    int unstable_bits = 0;
+    int resume_offset = 0;
+    checksum_set_t checksums;
+
+    // Only a dump written as it arrives leaves a partial file to pick up
+    if (resume && !streaming)
+    {
+        fprintf(stderr, "\r\nA read with '--reads' or line scrambling is written out only when complete and cannot be resumed.\r\n");
+        return false;
+    }
+
+    read_buffer = malloc(dev_size);
+
+    // A single read is written out as it arrives. A consensus read can only
+    // be written once every read has been voted on, and a scrambled one once
+    // the whole device is in.
+    _g_read_streaming = streaming;
+
+    // A single unscrambled read can be checked against the library as it
+    // arrives. Otherwise only the finished read is looked up.
+    _g_read_identifying = (library_active() && num_reads == 1 && !transform_active());
+
+    if (_g_read_identifying)
+        library_begin(read_buffer, dev_size);
+
+    if (streaming)
+    {
+        if ((resume_offset = dump_begin(filenames, num_filenames, read_buffer, dev_size, resume)) < 0)
+        {
+            success = false;
+            goto out;
+        }
+
+        dump_open = true;
+
+        if (resume_offset > 0)
+            printf("Resuming partial dump at 0x%04X. Earlier bytes are read again and checked against it.\r\n\r\n", resume_offset);
+    }
+
+    printf("Reading device...\r\n\r\n");
+
+    // Weak bits on old parts can read differently each time. Every read is
+    // voted on bit by bit as it arrives, so only one read is held at a time.
+    if (num_reads > 1)
+    {
+        votes = calloc(dev_size * 8, sizeof(uint16_t));
+        unstable = malloc(dev_size);
+    }
+
+    _g_num_reads = num_reads;
+
+    print_progress_outline();
+
+    for (int read = 0; read < num_reads; read++)
+    {
+        _g_read_index = read;
+
+        if (num_reads > 1)
+            print_passes(read + 1, num_reads);
+
+        if (read > 0)
+            pgm_reset(port);
+
+        if (!pgm_read(port, dev_type, read_buffer, NULL, &print_read_progress, &read_chunk, NULL))
+        {
+            int bytes_read = pgm_get_last_offset() > resume_offset ? pgm_get_last_offset() : resume_offset;
+
+            print_target_error(true);
+            if (_g_last_error == PGM_ERR_CANCELLED)
+            {
+                if (num_reads > 1)
+                    fprintf(stderr, "Completed %d of %d reads. ", read, num_reads);
+                fprintf(stderr, "Read 0x%04X of 0x%04X bytes.\r\n", pgm_get_last_offset(), dev_size);
+            }
+            if (streaming && bytes_read > 0 && num_filenames == 1 && hexfile_format(filenames[0]) == HexFormatBinary && strcmp(filenames[0], STDIO_FILENAME))
+                fprintf(stderr, "Partial dump of 0x%04X bytes kept in %s" DUMP_PART_EXTENSION ". Use '--resume' to continue.\r\n", bytes_read, filenames[0]);
+            success = false;
+            goto out;
+        }
+
+        if (votes)
+            image_add_votes(read_buffer, dev_size, votes);
+    }
+
+    printf("\r\n\r\nRead successful.\r\n");
+
+    if (votes)
+        unstable_bits = image_consensus(votes, dev_size, num_reads, pgm_get_erased_value(dev_type), read_buffer, unstable);
+
+    if (transform_active())
+    {
+        read_buffer = unscramble(read_buffer, dev_size);
+        if (unstable)
+            unstable = unscramble(unstable, dev_size);
+    }
+
+    if (votes)
+    {
+        int printed = 0;
+
+        if (unstable_bits)
+        {
+            printf("\r\n%d bits did not read the same on all %d reads. Saved the majority value.\r\n", unstable_bits, num_reads);
+
+            for (int offset = 0; offset < dev_size; offset++)
+            {
+                if (!unstable[offset])
+                    continue;
+
+                if (printed++ < MAX_UNSTABLE_PRINTED)
+                    printf("Unstable at 0x%04X. Majority=0x%02X Bits=0x%02X\r\n", offset, read_buffer[offset], unstable[offset]);
+            }
+
+            if (printed > MAX_UNSTABLE_PRINTED)
+                printf("... and %d more.\r\n", printed - MAX_UNSTABLE_PRINTED);
+        }
+        else
+        {
+            printf("\r\nAll %d reads matched.\r\n", num_reads);
+        }
+    }
+
+    if (!streaming)
+    {
+        if (dump_begin(filenames, num_filenames, read_buffer, dev_size, false) < 0)
+        {
+            success = false;
+            goto out;
+        }
+
+        dump_open = true;
+        dump_chunk_read(dev_size);
+    }
+
+    dump_open = false;
+
+    if (!dump_end(true))
     {
-        fprintf(stderr, "\r\nFailed to open output file for writing.\r\n");
         success = false;
         goto out;
     }
 
-    fwrite(read_buffer, sizeof(uint8_t), dev_size, output_file);
-    fclose(output_file);
+    dump_get_checksums(&checksums);
+    printf("\r\n");
+    checksum_set_print(&checksums);
+
+    if (library_active())
+    {
+        printf("\r\n");
+
+        if (print_identification(read_buffer, dev_size, nearest) && _g_read_identifying && library_unique_offset() >= 0)
+            printf("Unique in library after 0x%04X of 0x%04X bytes.\r\n", library_unique_offset(), dev_size);
+    }
+
+    // The map is named after the first output that is a file
+    if (unstable_bits)
+    {
+        const char *map_base = NULL;
+
+        for (int i = 0; i < num_filenames && !map_base; i++)
+        {
+            if (strcmp(filenames[i], STDIO_FILENAME))
+                map_base = filenames[i];
+        }
+
+        if (!map_base)
+        {
+            fprintf(stderr, "\r\nWarning: Unstable bit map not saved, as the read went to stdout. Add '-f FILE' to keep it.\r\n");
+        }
+        else if (!write_unstable_map(map_base, unstable, dev_size))
+        {
+            success = false;
+            goto out;
+        }
+    }
+
     success = true;
 
 out:
+    if (dump_open)
+        dump_end(false);
     pgm_reset(port);
     if (read_buffer)
         free(read_buffer);
+    if (unstable)
+        free(unstable);
+    if (votes)
+        free(votes);
     return success;
 }
 
-static bool target_blank_check(port_handle_t port, device_type_t dev_type)
+// Read chunk callback. Feeds the streaming dump and narrows the library, and
+// names the ROM next to the progress bar as soon as it is the only one left.
+
+static void read_chunk(int bytes_read)
 {
-    bool success = false;
+    bool was_unique;
+    const char *name;
 
-    if (!target_measure_12v(port, dev_type))
+    if (_g_read_streaming)
+        dump_chunk_read(bytes_read);
+
+    if (!_g_read_identifying)
+        return;
+
+    was_unique = library_unique_name() != NULL;
+    library_chunk_read(bytes_read);
+
+    if (!was_unique && (name = library_unique_name()))
+        print_progress_note(name);
+}
+
+// Identifies a dump already on disk, of any size
+
+static bool identify_file(const char *filename, int nearest)
+{
+    const uint8_t *data;
+    size_t size;
+
+    if (!image_map(filename, &data, &size))
+        return false;
+
+    if (!size || size > LIBRARY_MAX_ROM_SIZE)
+    {
+        fprintf(stderr, "\r\n%s is not the size of a ROM.\r\n", filename);
+        image_unmap(data, size);
+        return false;
+    }
+
+    printf("\r\n");
+    print_identification(data, (int)size, nearest);
+    image_unmap(data, size);
+
+    return true;
+}
+
+// A dump from a worn chip rarely matches exactly, so when nothing does, the
+// closest ROMs by number of differing bits are listed instead. Returns true
+// on an exact match.
+
+static bool print_identification(const uint8_t *data, int size, int nearest)
+{
+    if (library_identify(data, size, &print_library_match))
+        return true;
+
+    printf("Not found in library.\r\n");
+
+    _g_nearest_size = size;
+
+    if (nearest > 0)
+    {
+        printf("\r\nNearest library ROMs:\r\n");
+        if (!library_nearest(data, size, nearest, &print_nearest_match))
+            printf("None of 0x%04X bytes.\r\n", size);
+    }
+
+    return false;
+}
+
+// Finds where a dump sits inside the larger images in the library. Unless
+// given, the tolerance allows 1% of the dump's bits to be wrong.
+
+static bool locate_file(const char *filename, int tolerance)
+{
+    const uint8_t *data;
+    size_t size;
+
+    if (!image_map(filename, &data, &size))
+        return false;
+
+    if (size < LIBRARY_LOCATE_MIN_SIZE || size > LIBRARY_MAX_ROM_SIZE)
+    {
+        fprintf(stderr, "\r\n%s must be 0x%04X to 0x%X bytes to locate.\r\n", filename, LIBRARY_LOCATE_MIN_SIZE, LIBRARY_MAX_ROM_SIZE);
+        image_unmap(data, size);
+        return false;
+    }
+
+    if (tolerance < 0)
+        tolerance = (int)(size * 8) / 100;
+
+    printf("\r\n");
+
+    if (!library_locate(data, (int)size, tolerance, &print_location))
+        printf("Not found in any library ROM.\r\n");
+
+    image_unmap(data, size);
+
+    return true;
+}
+
+static void print_location(const char *name, int offset, int distance)
+{
+    if (distance)
+        printf("Found in %s at 0x%06X, %d bits differ\r\n", name, offset, distance);
+    else
+        printf("Found in %s at 0x%06X\r\n", name, offset);
+}
+
+static void print_library_match(const char *name)
+{
+    printf("Identified as %s\r\n", name);
+}
+
+static void print_nearest_match(const char *name, int distance)
+{
+    printf("%s: %d bits differ (%.2f%%)\r\n", name, distance, (distance * 100.0) / (_g_nearest_size * 8));
+}
+
+static uint8_t *scramble(const uint8_t *board, int size)
+{
+    uint8_t *chip = malloc(size);
+
+    transform_to_chip(board, chip);
+
+    return chip;
+}
+
+static uint8_t *unscramble(uint8_t *chip, int size)
+{
+    uint8_t *board = malloc(size);
+
+    transform_from_chip(chip, board);
+    free(chip);
+
+    return board;
+}
+
+// The map has a byte per device location with the unstable bits set, so it
+// can be given straight to '--mask' when verifying against the dump
+
+static bool write_unstable_map(const char *filename, const uint8_t *unstable, int size)
+{
+    FILE *map_file;
+    char *map_filename = malloc(strlen(filename) + sizeof(UNSTABLE_EXTENSION));
+
+    strcpy(map_filename, filename);
+    strcat(map_filename, UNSTABLE_EXTENSION);
+
+#ifdef _WIN32
+    if (fopen_s(&map_file, map_filename, "wb"))
+#else
+    if (!(map_file = fopen(map_filename, "wb")))
+#endif /* _WIN32 */
+    {
+        fprintf(stderr, "\r\nFailed to open unstable bit map for writing.\r\n");
+        free(map_filename);
         return false;
+    }
+
+    fwrite(unstable, sizeof(uint8_t), size, map_file);
+    fclose(map_file);
+
+    printf("Unstable bit map saved to %s\r\n", map_filename);
+    free(map_filename);
+
+    return true;
+}
+
+static bool target_blank_check(port_handle_t port, device_type_t dev_type)
+{
+    bool success = false;
 
     if (!work_blank_check(port, dev_type, NULL))
     {
@@ -478,62 +1466,166 @@ out:
     return success;
 }
 
-static bool target_write(port_handle_t port, device_type_t dev_type, const char *filename, int num_passes, bool blank_check, bool verify, bool hit_till_set, uint8_t parameter)
+static bool target_blank_map(port_handle_t port, device_type_t dev_type)
 {
     bool success = false;
-    bool blank;
-    bool matches;
-    uint8_t *write_buffer = NULL;
-    uint8_t *file_buffer = NULL;
-    write_result_t write_result;
-    FILE *input_file;
-    size_t file_size;
-    size_t file_read;
-    int dev_size = pgm_get_dev_size(dev_type);
+    int programmed_bits;
 
-#ifdef _WIN32
-    if (fopen_s(&input_file, filename, "rb"))
-#else
-    if (!(input_file = fopen(filename, "rb")))
-#endif /* _WIN32 */
+    if (!work_blank_map(port, dev_type, true, &programmed_bits))
     {
-        fprintf(stderr, "\r\nFailed to open input file for reading.\r\n");
-        return false;
+        success = false;
+        goto out;
     }
 
-    fseek(input_file, 0, SEEK_END);
-    file_size = ftell(input_file);
-    fseek(input_file, 0, SEEK_SET);
+    success = true;
 
-    write_buffer = malloc(dev_size);
-    file_buffer = malloc(file_size);
+out:
+    pgm_reset(port);
+    return success;
+}
 
-    file_read = fread(file_buffer, sizeof(uint8_t), file_size, input_file);
-    fclose(input_file);
+// Polls a device sitting in the UV eraser so it can be taken out as soon as
+// it is blank, rather than over-erasing it on a guessed time
 
-    if (dev_type == D8748 || dev_type == D8749 || dev_type == D8741 || dev_type == D8742 || dev_type == C1702A)
-        memset(write_buffer, 0x00, dev_size);
-    else
-        memset(write_buffer, 0xFF, dev_size);
+static bool target_erase_monitor(port_handle_t port, device_type_t dev_type, int interval)
+{
+    bool success = false;
+    int programmed_bits;
+    int last_programmed_bits = -1;
+    int total_bits = pgm_get_dev_size(dev_type) * 8;
+    int elapsed = 0;
+    time_t start_time = time(NULL);
+
+    printf("Monitoring erase. Press Ctrl+C to stop.\r\n\r\n");
 
-    if (file_read != file_size)
+    for (;;)
     {
-        fprintf(stderr, "\r\nFailed to read all of input file.\r\n");
-        success = false;
-        goto out;
+        if (!work_blank_map(port, dev_type, false, &programmed_bits))
+        {
+            if (_g_last_error == PGM_ERR_CANCELLED && last_programmed_bits >= 0)
+                fprintf(stderr, "Stopped after %d:%02d with %d bits still programmed.\r\n", elapsed / 60, elapsed % 60, last_programmed_bits);
+            success = false;
+            goto out;
+        }
+
+        pgm_reset(port);
+
+        elapsed = (int)(time(NULL) - start_time);
+
+        if (programmed_bits != last_programmed_bits)
+        {
+            printf("[%3d:%02d] %d of %d bits programmed (%.1f%%)\r\n", elapsed / 60, elapsed % 60,
+                programmed_bits, total_bits, (programmed_bits * 100.0) / total_bits);
+            last_programmed_bits = programmed_bits;
+        }
+
+        if (!programmed_bits)
+            break;
+
+        for (int i = 0; i < interval * 10 && !_g_cancel_requested; i++)
+            Sleep(100);
     }
 
-    if (file_size > dev_size)
+    printf("\a\r\nDevice is blank after %d:%02d.\r\n\r\n", elapsed / 60, elapsed % 60);
+    success = true;
+
+out:
+    pgm_reset(port);
+    return success;
+}
+
+static bool target_compat_check(port_handle_t port, device_type_t dev_type, const uint8_t *image)
+{
+    bool success = false;
+    bool compatible;
+
+    if (!work_compat_check(port, dev_type, image, &compatible))
     {
-        fprintf(stderr, "\r\nInput file too large for device.\r\n");
         success = false;
         goto out;
     }
 
-    memcpy(write_buffer, file_buffer, file_size);
+    success = compatible;
 
-    if (!target_measure_12v(port, dev_type))
+out:
+    pgm_reset(port);
+    return success;
+}
+
+static bool target_write(port_handle_t port, device_type_t dev_type, const uint8_t *image, int num_passes, bool blank_check, bool reuse, bool verify, bool hit_till_set, uint8_t parameter,
+    const char *checkpoint_filename, bool resume, bool adaptive, float overprogram, const char *lot_filename, const verify_options_t *verify_options)
+{
+    bool success = false;
+    bool blank;
+    bool matches;
+    bool have_lot_map = false;
+    int first_pass = 0;
+    int resume_offset = 0;
+    int verified_pass = 0;
+    int adaptive_group = 1;
+    uint8_t *resume_buffer = NULL;
+    write_result_t write_result;
+    tuning_record_t lot_record;
+    checkpoint_t checkpoint;
+    int dev_size = pgm_get_dev_size(dev_type);
+
+    if (hit_till_set)
+        num_passes = 1;
+
+    memset(&write_result, 0, sizeof(write_result));
+    memset(&checkpoint, 0, sizeof(checkpoint));
+    checkpoint.image_crc = crc32(image, dev_size);
+    checkpoint.dev_type = dev_type;
+    checkpoint.num_passes = num_passes;
+
+    if (resume && !checkpoint_filename)
+    {
+        fprintf(stderr, "\r\nA write from stdin has no checkpoint and cannot be resumed.\r\n");
         return false;
+    }
+
+    if (resume)
+    {
+        checkpoint_t saved;
+
+        if (!checkpoint_load(checkpoint_filename, &saved))
+        {
+            fprintf(stderr, "\r\nNo checkpoint found to resume from.\r\n");
+            return false;
+        }
+
+        if (saved.image_crc != checkpoint.image_crc || saved.dev_type != checkpoint.dev_type || saved.num_passes != checkpoint.num_passes)
+        {
+            fprintf(stderr, "\r\nCheckpoint does not match this image, device and number of passes.\r\n");
+            return false;
+        }
+
+        // A finished write removes its checkpoint, so one that claims every
+        // pass is done, or points outside the device, is damaged
+        if (saved.passes_completed < 0 || saved.passes_completed >= num_passes ||
+            saved.chunk_offset < 0 || saved.chunk_offset > dev_size ||
+            saved.verified_pass < 0 || saved.verified_pass > num_passes)
+        {
+            fprintf(stderr, "\r\nCheckpoint is damaged and cannot be resumed from.\r\n");
+            return false;
+        }
+
+        first_pass = saved.passes_completed;
+        checkpoint.passes_completed = saved.passes_completed;
+        checkpoint.verified_pass = saved.verified_pass;
+        verified_pass = saved.verified_pass;
+
+        // Hit-till-set cannot skip bytes already written, so its single pass
+        // restarts from the beginning. Bytes which have already been set are
+        // quickly confirmed by the programmer.
+        if (!hit_till_set)
+            resume_offset = saved.chunk_offset;
+
+        printf("\r\nResuming write at pass %d of %d, offset 0x%04X.\r\n\r\n", first_pass + 1, num_passes, resume_offset);
+
+        // The chip is already partially programmed
+        blank_check = false;
+    }
 
     if (blank_check)
     {
@@ -543,40 +1635,106 @@ static bool target_write(port_handle_t port, device_type_t dev_type, const char
             goto out;
         }
 
-        if (!blank)
+        if (!pgm_reset(port))
         {
+            print_target_error(true);
             success = false;
             goto out;
         }
 
-        if (!pgm_reset(port))
+        if (!blank && reuse)
+        {
+            if (!work_compat_check(port, dev_type, image, &blank))
+            {
+                success = false;
+                goto out;
+            }
+        }
+
+        if (!blank)
         {
-            print_target_error(true);
             success = false;
             goto out;
         }
     }
 
-    printf("Writing device...\r\n\r\n");
+    if (hit_till_set || num_passes < 2)
+        adaptive = false;
 
-    if (hit_till_set)
-        num_passes = 1;
+    if (adaptive)
+    {
+        adaptive_group = num_passes / ADAPTIVE_CHECKS;
+        if (adaptive_group < 1)
+            adaptive_group = 1;
+
+        if (overprogram < 0)
+            overprogram = 0;
+    }
+
+    if (!checkpoint_filename)
+        fprintf(stderr, "\r\nWarning: Image is from stdin. Write cannot be resumed.\r\n\r\n");
+    else if (!checkpoint_begin(checkpoint_filename, &checkpoint))
+        fprintf(stderr, "\r\nWarning: Unable to create checkpoint file. Write cannot be resumed.\r\n\r\n");
+
+    printf("Writing device...\r\n\r\n");
 
     print_progress_outline();
 
-    for (int pass = 0; pass < num_passes; pass++)
+    for (int pass = first_pass; pass < num_passes; pass++)
     {
+        const uint8_t *pass_buffer = image;
+
         if (!hit_till_set)
             print_passes(pass + 1, num_passes);
 
-        if (!pgm_write(port, dev_type, write_buffer, pass, num_passes, hit_till_set, parameter, &write_result, &print_progress, NULL))
+        // Finish an interrupted pass without pulsing the locations it already
+        // covered again, by sending the erased value for them
+        if (pass == first_pass && resume_offset > 0)
+        {
+            resume_buffer = malloc(dev_size);
+            memcpy(resume_buffer, image, dev_size);
+            memset(resume_buffer, pgm_get_erased_value(dev_type), resume_offset);
+            pass_buffer = resume_buffer;
+        }
+
+        if (!pgm_write(port, dev_type, (uint8_t *)pass_buffer, pass, num_passes, hit_till_set, parameter, &write_result, &print_progress, &checkpoint_chunk_written, NULL))
         {
             print_target_error(true);
+            fprintf(stderr, "Completed %d of %d passes, 0x%04X of 0x%04X bytes into pass %d.%s\r\n",
+                pass, num_passes, pgm_get_last_offset(), dev_size, pass + 1, checkpoint_filename ? " Use '--resume' to continue." : "");
             success = false;
             goto out;
         }
+
+        checkpoint_pass_complete(pass);
+
+        if (adaptive && !verified_pass && ((pass + 1) % adaptive_group) == 0)
+        {
+            if (!work_adaptive_check(port, dev_type, image, &matches))
+            {
+                success = false;
+                goto out;
+            }
+
+            if (matches)
+            {
+                verified_pass = pass + 1;
+                checkpoint_verified(verified_pass);
+            }
+        }
+
+        if (verified_pass && (pass + 1) >= adaptive_total_passes(verified_pass, overprogram, num_passes))
+        {
+            printf("\r\n\r\nDevice verified after %d passes. Stopped after %d of %d passes.", verified_pass, pass + 1, num_passes);
+            break;
+        }
     }
 
+    checkpoint_end(true);
+
+    if (hit_till_set && lot_filename)
+        have_lot_map = work_record_lot(port, dev_type, &write_result, lot_filename, &lot_record);
+
     if (verify)
     {
         printf("\r\n\r\n");
@@ -588,7 +1746,14 @@ static bool target_write(port_handle_t port, device_type_t dev_type, const char
             goto out;
         }
 
-        if (!work_verify(port, dev_type, filename, &matches))
+        if (!work_verify(port, dev_type, image, verify_options, &matches))
+        {
+            success = false;
+            goto out;
+        }
+
+        // A failed verify must stop any operations that follow in the session
+        if (!matches)
         {
             success = false;
             goto out;
@@ -602,33 +1767,103 @@ static bool target_write(port_handle_t port, device_type_t dev_type, const char
     {
         printf("Maximum number of retries on a single byte: %u\r\n", write_result.max_writes_per_byte);
         printf("Total number of writes across entire device: %u\r\n", write_result.total_writes);
+
+        if (have_lot_map)
+        {
+            printf("Bytes by number of writes to set:");
+
+            for (int i = 0; i < 256; i++)
+            {
+                if (lot_record.histogram[i])
+                    printf(" %dx=%u", i, lot_record.histogram[i]);
+            }
+
+            printf("\r\n");
+        }
     }
 
     success = true;
 
 out:
+    checkpoint_end(false);
     pgm_reset(port);
-    if (write_buffer)
-        free(write_buffer);
-    if (file_buffer)
-        free(file_buffer);
+    if (resume_buffer)
+        free(resume_buffer);
     return success;
 }
 
-static bool target_verify(port_handle_t port, device_type_t dev_type, const char *filename)
+// Adds this chip to the lot history. The per-byte write map gives the full
+// distribution; with older firmware only the worst byte is recorded.
+
+static bool work_record_lot(port_handle_t port, device_type_t dev_type, const write_result_t *write_result, const char *lot_filename, tuning_record_t *record)
 {
-    bool success = false;
+    int dev_size = pgm_get_dev_size(dev_type);
+    uint8_t *write_map = malloc(dev_size);
+    bool have_map = false;
 
-    if (!target_measure_12v(port, dev_type))
+    memset(record, 0, sizeof(tuning_record_t));
+    record->magic = TUNING_MAGIC;
+
+    if (pgm_write_map(port, dev_type, write_map))
+    {
+        tuning_record_from_map(record, write_map, dev_size);
+        have_map = true;
+    }
+    else
+    {
+        record->max_writes = write_result->max_writes_per_byte;
+        serial_flush(port);
+    }
+
+    if (!tuning_append(lot_filename, record))
+        fprintf(stderr, "\r\nWarning: Unable to update lot history file.\r\n");
+
+    free(write_map);
+
+    return have_map;
+}
+
+// Reads the device back between groups of passes. The read stops at the
+// first location which doesn't match yet, so it is cheap until the very end.
+
+static bool work_adaptive_check(port_handle_t port, device_type_t dev_type, const uint8_t *image, bool *matches)
+{
+    verify_result_t verify_result;
+
+    if (!pgm_reset(port) || !pgm_read(port, dev_type, (uint8_t *)image, &verify_result, NULL, NULL, NULL) || !pgm_reset(port))
+    {
+        print_target_error(true);
         return false;
+    }
+
+    *matches = verify_result.matches;
+
+    return true;
+}
+
+static int adaptive_total_passes(int verified_pass, float overprogram, int num_passes)
+{
+    float extra = verified_pass * overprogram;
+    int total = verified_pass + (int)extra;
+
+    if ((int)extra < extra)
+        total++;
+
+    return total < num_passes ? total : num_passes;
+}
+
+static bool target_verify(port_handle_t port, device_type_t dev_type, const uint8_t *image, const verify_options_t *verify_options)
+{
+    bool success = false;
+    bool matches;
 
-    if (!work_verify(port, dev_type, filename, NULL))
+    if (!work_verify(port, dev_type, image, verify_options, &matches))
     {
         success = false;
         goto out;
     }
 
-    success = true;
+    success = matches;
 
 out:
     pgm_reset(port);
@@ -637,6 +1872,7 @@ out:
 
 static bool target_measure_12v(port_handle_t port, device_type_t dev_type)
 {
+    const device_t *device = device_get(dev_type);
     float measured_voltage;
 
     if (!pgm_check_supply_voltage(port, &measured_voltage))
@@ -645,18 +1881,17 @@ static bool target_measure_12v(port_handle_t port, device_type_t dev_type)
         return false;
     }
 
-    if (dev_type == C2704 || dev_type == C2708)
+    if (measured_voltage < HOST_MIN_VOLTAGE || measured_voltage >= HOST_MAX_VOLTAGE)
     {
-        if (measured_voltage < 11.5 || measured_voltage >= 13.0)
-        {
-            fprintf(stderr, "\r\nSupply voltage is out of range for this device type.\r\n\r\nVin=%.2fV Min=12.00V Max=13.00V\r\n", measured_voltage);
-            return false;
-        }
+        fprintf(stderr, "\r\nProgrammer host must be connected to a 12V supply.\r\n\r\nVin=%.2fV Min=%.2fV Max=%.2fV\r\n",
+            measured_voltage, HOST_MIN_VOLTAGE, HOST_MAX_VOLTAGE);
+        return false;
     }
 
-    if (measured_voltage < 10.0 || measured_voltage >= 14.0)
+    if (device && (measured_voltage < device->min_voltage || measured_voltage >= device->max_voltage))
     {
-        fprintf(stderr, "\r\nProgrammer host must be connected to a 12V supply.\r\n\r\nVin=%.2fV Min=10.00V Max=14.00V\r\n", measured_voltage);
+        fprintf(stderr, "\r\nSupply voltage is out of range for this device type.\r\n\r\nVin=%.2fV Min=%.2fV Max=%.2fV\r\n",
+            measured_voltage, device->min_voltage, device->max_voltage);
         return false;
     }
 
@@ -665,68 +1900,131 @@ static bool target_measure_12v(port_handle_t port, device_type_t dev_type)
     return true;
 }
 
-static bool work_verify(port_handle_t port, device_type_t dev_type, const char *filename, bool *matches)
+static bool target_probe(port_handle_t port)
 {
-    bool success = false;
-    uint8_t *input_buffer = NULL;
-    uint8_t *file_buffer = NULL;
-
-    verify_result_t verify_result;
-    FILE *input_file;
-    int dev_size = pgm_get_dev_size(dev_type);
-    size_t file_size;
-    size_t file_read;
+    device_type_t detected;
 
-#ifdef _WIN32
-    if (fopen_s(&input_file, filename, "rb"))
-#else
-    if (!(input_file = fopen(filename, "rb")))
-#endif /* _WIN32 */
-    {
-        fprintf(stderr, "\r\nFailed to open input file for reading.\r\n");
+    if (!target_measure_12v(port, NotSet))
         return false;
-    }
 
-    fseek(input_file, 0, SEEK_END);
-    file_size = ftell(input_file);
-    fseek(input_file, 0, SEEK_SET);
+    return work_probe(port, true, &detected);
+}
+
+// There is no identify command, so every device type is tried with a start
+// read which is reset straight away. The shield and switch position are
+// checked before the chip is touched. A type is only detected when the shield
+// accepts no other. The types sharing a socket differ only in size, so a blank
+// check can't tell them apart either; with 'blank_check' the results are just
+// listed for the operator to judge.
 
-    input_buffer = malloc(dev_size);
-    file_buffer = malloc(file_size);
+static bool work_probe(port_handle_t port, bool blank_check, device_type_t *detected)
+{
+    int num_types = device_count();
+    device_type_t *accepted = malloc(num_types * sizeof(device_type_t));
+    device_type_t *switch_types = malloc(num_types * sizeof(device_type_t));
+    int num_accepted = 0;
+    int num_switch = 0;
+    bool success = false;
 
-    file_read = fread(file_buffer, sizeof(uint8_t), file_size, input_file);
-    fclose(input_file);
+    *detected = NotSet;
 
-    if (dev_type == D8748 || dev_type == D8749 || dev_type == D8741 || dev_type == D8742 || dev_type == C1702A)
-        memset(input_buffer, 0x00, dev_size);
-    else
-        memset(input_buffer, 0xFF, dev_size);
+    printf("Probing shield...\r\n");
 
-    if (file_read != file_size)
+    for (int i = 0; i < num_types; i++)
     {
-        fprintf(stderr, "\r\nFailed to read all of input file.\r\n");
-        *matches = false;
-        success = false;
-        goto out;
+        if (!pgm_probe(port, (device_type_t)i))
+        {
+            print_target_error(true);
+            goto out;
+        }
+
+        if (_g_last_error == PGM_ERR_OK || _g_last_error == PGM_ERR_PROCEED_DUAL_SOCKET)
+            accepted[num_accepted++] = (device_type_t)i;
+        else if (_g_last_error == PGM_ERR_INCORRECT_SWITCH_POSITION)
+            switch_types[num_switch++] = (device_type_t)i;
+        else if (_g_last_error == PGM_ERR_NO_HARDWARE)
+        {
+            print_target_error(true);
+            goto out;
+        }
     }
 
-    if (file_size > dev_size)
+    print_device_list("Shield accepts", accepted, num_accepted);
+    print_device_list("After moving the selection switch", switch_types, num_switch);
+
+    if (num_accepted == 1)
+        *detected = accepted[0];
+
+    if (blank_check && num_accepted > 1)
+        printf("\r\n");
+
+    for (int i = 0; blank_check && num_accepted > 1 && i < num_accepted; i++)
     {
-        fprintf(stderr, "\r\nInput file is larger than device.\r\n");
-        *matches = false;
-        success = false;
-        goto out;
+        const device_t *device = device_get(accepted[i]);
+        blank_check_result_t blank_check_result;
+
+        if (!(device->capabilities & DEVICE_CAP_BLANK_CHECK))
+            continue;
+
+        if (!pgm_blank_check(port, accepted[i], &blank_check_result, NULL))
+        {
+            print_target_error(true);
+            goto out;
+        }
+
+        pgm_reset(port);
+
+        if (blank_check_result.blank)
+            printf("Blank as %s\r\n", device->name);
+        else
+            printf("Not blank as %s. Offset = 0x%04X Data = 0x%02X\r\n", device->name, blank_check_result.offset, blank_check_result.data);
     }
 
-    memcpy(input_buffer, file_buffer, file_size);
+    if (*detected != NotSet)
+        printf("\r\nDetected device: %s\r\n", device_get(*detected)->name);
+    else if (num_accepted)
+        printf("\r\nThe shield accepts more than one device type. Specify it with '-d'.\r\n");
+    else
+        printf("\r\nThe shield accepts no device type in its current switch position.\r\n");
+
+    success = true;
+
+out:
+    free(accepted);
+    free(switch_types);
+    return success;
+}
+
+static void print_device_list(const char *heading, const device_type_t *types, int count)
+{
+    if (!count)
+        return;
+
+    printf("\r\n%s:", heading);
+
+    for (int i = 0; i < count; i++)
+        printf(" %s", device_get(types[i])->name);
+
+    printf("\r\n");
+}
+
+static bool work_verify(port_handle_t port, device_type_t dev_type, const uint8_t *image, const verify_options_t *verify_options, bool *matches)
+{
+    bool success = false;
+    verify_result_t verify_result;
+
+    if (verify_options->report != VerifyReportNone || verify_options->care_mask)
+        return work_verify_full(port, dev_type, image, verify_options, matches);
 
     printf("Verifying device...\r\n\r\n");
 
     print_progress_outline();
 
-    if (!pgm_read(port, dev_type, input_buffer, &verify_result, &print_progress, NULL))
+    if (!pgm_read(port, dev_type, (uint8_t *)image, &verify_result, &print_progress, NULL, NULL))
     {
         print_target_error(true);
+        if (_g_last_error == PGM_ERR_CANCELLED)
+            fprintf(stderr, "Verified 0x%04X of 0x%04X bytes.\r\n", pgm_get_last_offset(), pgm_get_dev_size(dev_type));
         success = false;
         goto out;
     }
@@ -748,13 +2046,115 @@ static bool work_verify(port_handle_t port, device_type_t dev_type, const char *
 
 out:
     pgm_reset(port);
-    if (input_buffer)
-        free(input_buffer);
-    if (file_buffer)
-        free(file_buffer);
     return success;
 }
 
+// Reads the whole device, then reports every difference from the image
+// rather than only the first one
+
+static bool work_verify_full(port_handle_t port, device_type_t dev_type, const uint8_t *image, const verify_options_t *verify_options, bool *matches)
+{
+    bool success = false;
+    uint8_t *read_buffer = NULL;
+    int dev_size = pgm_get_dev_size(dev_type);
+    int mismatches;
+
+    printf("Verifying device...\r\n\r\n");
+
+    read_buffer = malloc(dev_size);
+
+    print_progress_outline();
+
+    if (!pgm_read(port, dev_type, read_buffer, NULL, &print_progress, NULL, NULL))
+    {
+        print_target_error(true);
+        if (_g_last_error == PGM_ERR_CANCELLED)
+            fprintf(stderr, "Verified 0x%04X of 0x%04X bytes.\r\n", pgm_get_last_offset(), dev_size);
+        success = false;
+        goto out;
+    }
+
+    printf("\r\n\r\n");
+
+    _g_verify_report = verify_options->report;
+    _g_verify_erased_value = pgm_get_erased_value(dev_type);
+    _g_verify_unprogrammed_bits = 0;
+    _g_verify_overprogrammed_bits = 0;
+    _g_verify_report_file = dump_get_stdout() ? dump_get_stdout() : stdout;
+
+    if (verify_options->report == VerifyReportCsv && verify_options->report_filename)
+    {
+#ifdef _WIN32
+        if (fopen_s(&_g_verify_report_file, verify_options->report_filename, "w"))
+#else
+        if (!(_g_verify_report_file = fopen(verify_options->report_filename, "w")))
+#endif /* _WIN32 */
+        {
+            fprintf(stderr, "\r\nFailed to open report file for writing.\r\n");
+            success = false;
+            goto out;
+        }
+    }
+
+    if (verify_options->report == VerifyReportCsv)
+        fprintf(_g_verify_report_file, "offset,file,device,diff,unprogrammed,overprogrammed\n");
+
+    mismatches = image_compare(image, read_buffer, verify_options->care_mask, dev_size, &print_mismatch);
+
+    if (verify_options->report == VerifyReportCsv && verify_options->report_filename)
+        fclose(_g_verify_report_file);
+    else
+        fflush(_g_verify_report_file);
+
+    if (mismatches)
+    {
+        fprintf(stderr, "\r\nVerify failed. %d bytes differ. %d bits should be programmed but are not, %d bits are programmed but should not be.\r\n",
+            mismatches, _g_verify_unprogrammed_bits, _g_verify_overprogrammed_bits);
+    }
+    else
+    {
+        printf("Verify successful.\r\n\r\n");
+    }
+
+    *matches = (mismatches == 0);
+    success = true;
+
+out:
+    pgm_reset(port);
+    if (read_buffer)
+        free(read_buffer);
+    return success;
+}
+
+// Unprogrammed bits are programmed in the file but still erased on the device
+// (weak or under-programmed cells); overprogrammed bits are the reverse and
+// can only be fixed by erasing
+
+static void print_mismatch(int offset, uint8_t image, uint8_t device, uint8_t care)
+{
+    uint8_t unprogrammed = (image ^ _g_verify_erased_value) & ~(device ^ _g_verify_erased_value) & care;
+    uint8_t overprogrammed = (device ^ _g_verify_erased_value) & ~(image ^ _g_verify_erased_value) & care;
+
+    for (int bit = 0; bit < 8; bit++)
+    {
+        if (unprogrammed & (1 << bit))
+            _g_verify_unprogrammed_bits++;
+        if (overprogrammed & (1 << bit))
+            _g_verify_overprogrammed_bits++;
+    }
+
+    if (_g_verify_report == VerifyReportCsv)
+    {
+        fprintf(_g_verify_report_file, "0x%04X,0x%02X,0x%02X,0x%02X,0x%02X,0x%02X\n",
+            offset, image, device, (image ^ device) & care, unprogrammed, overprogrammed);
+    }
+    else if (_g_verify_report == VerifyReportSummary)
+    {
+        printf("Mismatch at 0x%04X. File=0x%02X Device=0x%02X Diff=0x%02X Unprogrammed=0x%02X Overprogrammed=0x%02X\r\n",
+            offset, image, device, (image ^ device) & care, unprogrammed, overprogrammed);
+    }
+}
+
 static bool work_blank_check(port_handle_t port, device_type_t dev_type, bool *blank)
 {
     blank_check_result_t blank_check;
@@ -778,6 +2178,119 @@ static bool work_blank_check(port_handle_t port, device_type_t dev_type, bool *b
     return true;
 }
 
+static bool work_compat_check(port_handle_t port, device_type_t dev_type, const uint8_t *image, bool *compatible)
+{
+    bool success = false;
+    uint8_t *read_buffer = NULL;
+    int dev_size = pgm_get_dev_size(dev_type);
+    int incompatible;
+
+    printf("Checking device can be programmed without erasing...\r\n\r\n");
+
+    read_buffer = malloc(dev_size);
+
+    print_progress_outline();
+
+    if (!pgm_read(port, dev_type, read_buffer, NULL, &print_progress, NULL, NULL))
+    {
+        print_target_error(true);
+        success = false;
+        goto out;
+    }
+
+    _g_incompatible_printed = 0;
+
+    printf("\r\n\r\n");
+
+    incompatible = image_find_incompatible(read_buffer, image, dev_size, pgm_get_erased_value(dev_type), &print_incompatible);
+
+    if (incompatible > MAX_INCOMPATIBLE_PRINTED)
+        printf("... and %d more.\r\n", incompatible - MAX_INCOMPATIBLE_PRINTED);
+
+    if (incompatible)
+        printf("\r\nDevice cannot be programmed without erasing. %d locations conflict.\r\n\r\n", incompatible);
+    else
+        printf("Device can be programmed without erasing.\r\n\r\n");
+
+    *compatible = (incompatible == 0);
+    success = true;
+
+out:
+    pgm_reset(port);
+    if (read_buffer)
+        free(read_buffer);
+    return success;
+}
+
+// Reads the whole device and maps it against the erased value, rather than
+// stopping at the first non-blank location like the programmer's blank check
+
+static bool work_blank_map(port_handle_t port, device_type_t dev_type, bool print_ranges, int *programmed_bits)
+{
+    bool success = false;
+    uint8_t *read_buffer = NULL;
+    int dev_size = pgm_get_dev_size(dev_type);
+
+    if (print_ranges)
+    {
+        printf("Mapping device blank state...\r\n\r\n");
+        print_progress_outline();
+    }
+
+    read_buffer = malloc(dev_size);
+
+    if (!pgm_read(port, dev_type, read_buffer, NULL, print_ranges ? &print_progress : NULL, NULL, NULL))
+    {
+        print_target_error(true);
+        success = false;
+        goto out;
+    }
+
+    _g_blank_ranges = 0;
+    _g_blank_range_bytes = 0;
+
+    if (print_ranges)
+        printf("\r\n\r\n");
+
+    *programmed_bits = image_blank_map(read_buffer, dev_size, pgm_get_erased_value(dev_type), print_ranges ? &print_blank_range : NULL);
+
+    if (print_ranges)
+    {
+        if (*programmed_bits)
+        {
+            printf("\r\nDevice not blank. %d bytes in %d ranges, %d of %d bits programmed (%.1f%%).\r\n\r\n",
+                _g_blank_range_bytes, _g_blank_ranges, *programmed_bits, dev_size * 8, (*programmed_bits * 100.0) / (dev_size * 8));
+        }
+        else
+        {
+            printf("Device is blank.\r\n\r\n");
+        }
+    }
+
+    success = true;
+
+out:
+    if (read_buffer)
+        free(read_buffer);
+    return success;
+}
+
+static void print_blank_range(int offset, int length)
+{
+    _g_blank_ranges++;
+    _g_blank_range_bytes += length;
+
+    printf("Not blank: 0x%04X-0x%04X (%d bytes)\r\n", offset, offset + length - 1, length);
+}
+
+static void print_incompatible(int offset, uint8_t device, uint8_t image)
+{
+    if (_g_incompatible_printed++ >= MAX_INCOMPATIBLE_PRINTED)
+        return;
+
+    printf("Conflict at 0x%04X. File=0x%02X Device=0x%02X\r\n", offset, image, device);
+}
+
 
 static bool target_test(port_handle_t port, shield_type_t shield_type)
 {
@@ -823,7 +2336,7 @@ static bool target_test(port_handle_t port, shield_type_t shield_type)
     terminal_set_raw_mode();
 #endif /* _WIN32 */
 
-    while (1)
+    while (!_g_cancel_requested)
     {
         if (testlast != testidx)
         {
@@ -1031,6 +2544,9 @@ static void print_target_error(bool cli_mode)
 
     switch (_g_last_error)
     {
+    case PGM_ERR_CANCELLED:
+        fprintf(cli_mode ? stderr : stdout, "Cancelled by user. The target has been reset.");
+        break;
     case PGM_ERR_BADACK:
         fprintf(cli_mode ? stderr : stdout, "A protocol error occurred communicating with the target.");
         break;
@@ -1087,6 +2603,21 @@ static void print_passes(int pass, int num_passes)
     fflush(stdout);
 }
 
+static void print_progress_note(const char *note)
+{
+    int offset = PROGRESS_BAR_SEGMENTS - _g_segments_printed + 2;
+    int notelen;
+    printf("\033[%dC", offset);
+    notelen = printf("%.*s", MAX_NOTE_LENGTH, note);
+    printf("\033[%dD", offset + notelen);
+    fflush(stdout);
+}
+
+static void print_read_progress(int pct)
+{
+    print_progress(((_g_read_index * 100) + pct) / _g_num_reads);
+}
+
 static void print_progress(int pct)
 {
     int segments_needed = (PROGRESS_BAR_SEGMENTS * (pct * 100)) / 10000;
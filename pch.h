@@ -12,12 +12,17 @@
 #ifdef _WIN32
 #include <windows.h>
 #include <conio.h>
+#include <fcntl.h>
+#include <io.h>
 #else
+#include <dirent.h>
 #include <fcntl.h>
 #include <termios.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 #include <stdbool.h>
@@ -25,5 +30,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <time.h>
 
 #endif //PCH_H
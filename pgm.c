@@ -24,6 +24,7 @@
 #include "project.h"
 #include "serial.h"
 #include "pgm.h"
+#include "device.h"
 
 // excruciatingly small chunk sizes, to ensure that 16550A FIFO's are not overflowed - 
 // because there is no flow control on this thing
@@ -31,11 +32,27 @@
 #define READ_CHUNK_SIZE     8
 #define WRITE_CHUNK_SIZE    8
 
+// Lost or corrupted responses are retried this many times, the delay before
+// each attempt doubling from RESYNC_BACKOFF_MS
+
+#define RESYNC_MAX_ATTEMPTS 5
+#define RESYNC_BACKOFF_MS   10
+
 #define MAKE_U16(b1, b2) ((b1 << 8) | (b2))
 #define MAKE_U32(b1, b2, b3, b4) ((b1 << 24) | (b2 << 16) | (b3 << 8) | (b4))
 
+static bool read_device(port_handle_t port, device_type_t dev_type, uint8_t *buffer, verify_result_t *verify_result, int *resume_offset,
+    void (*pct_callback)(int pct), void (*chunk_callback)(int bytes_read), void (*ds_callback)(void));
+static bool blank_check_device(port_handle_t port, device_type_t dev_type, blank_check_result_t *blank_check_result, void (*ds_callback)(void));
+static bool write_device(port_handle_t port, device_type_t dev_type, uint8_t *buffer, int pass, int num_passes, bool hit_till_set,
+    uint8_t num_retries, write_result_t *write_result,
+    void (*pct_callback)(int pct), void (*ack_callback)(int bytes_written), void (*ds_callback)(void));
+static bool resync(port_handle_t port, int *attempts);
+static bool check_cancelled(void);
 static bool check_return_code(port_handle_t port, uint8_t command);
 
+static int _last_offset;
+
 bool pgm_check_supply_voltage(port_handle_t port, float *measured_voltage)
 {
     uint8_t buffer[2];
@@ -60,7 +77,60 @@ bool pgm_check_supply_voltage(port_handle_t port, float *measured_voltage)
     return true;
 }
 
-bool pgm_read(port_handle_t port, device_type_t dev_type, uint8_t *buffer, verify_result_t *verify_result, void (*pct_callback)(int pct), void (*ds_callback)(void))
+bool pgm_read(port_handle_t port, device_type_t dev_type, uint8_t *buffer, verify_result_t *verify_result, void (*pct_callback)(int pct), void (*chunk_callback)(int bytes_read), void (*ds_callback)(void))
+{
+    int bytes_read = 0;
+    int attempts = 0;
+
+    _last_offset = 0;
+
+    if (pct_callback)
+        pct_callback(0);
+
+    while (!read_device(port, dev_type, buffer, verify_result, &bytes_read, pct_callback, chunk_callback, attempts ? NULL : ds_callback))
+    {
+        if (!resync(port, &attempts))
+            return false;
+    }
+
+    return true;
+}
+
+bool pgm_blank_check(port_handle_t port, device_type_t dev_type, blank_check_result_t *blank_check_result, void (*ds_callback)(void))
+{
+    int attempts = 0;
+
+    while (!blank_check_device(port, dev_type, blank_check_result, attempts ? NULL : ds_callback))
+    {
+        if (!resync(port, &attempts))
+            return false;
+    }
+
+    return true;
+}
+
+// Writes are never resynced. If bytes were lost on the way to the programmer
+// it is still part way through a chunk, and would program whatever it was
+// sent next into the device. A failed write is left to the checkpoint.
+
+bool pgm_write(port_handle_t port, device_type_t dev_type, uint8_t *buffer, int pass, int num_passes, bool hit_till_set,
+    uint8_t num_retries, write_result_t *write_result, void (*pct_callback)(int pct), void (*ack_callback)(int bytes_written), void (*ds_callback)(void))
+{
+    _last_offset = 0;
+
+    if (pct_callback)
+        pct_callback(0);
+
+    return write_device(port, dev_type, buffer, pass, num_passes, hit_till_set, num_retries, write_result,
+        pct_callback, ack_callback, ds_callback);
+}
+
+// Reads the device. After a resync the read restarts from the beginning (the
+// programmer has no way to seek) and the chunks which were already received
+// are clocked through without being stored again.
+
+static bool read_device(port_handle_t port, device_type_t dev_type, uint8_t *buffer, verify_result_t *verify_result, int *resume_offset,
+    void (*pct_callback)(int pct), void (*chunk_callback)(int bytes_read), void (*ds_callback)(void))
 {
     uint8_t write_buffer[3];
     int total_size = pgm_get_dev_size(dev_type);
@@ -70,9 +140,6 @@ bool pgm_read(port_handle_t port, device_type_t dev_type, uint8_t *buffer, verif
     write_buffer[1] = ~CMD_START_READ;
     write_buffer[2] = (uint8_t)dev_type;
 
-    if (pct_callback)
-        pct_callback(0);
-
     if (!serial_write(port, write_buffer, 3))
         return false;
 
@@ -88,8 +155,12 @@ bool pgm_read(port_handle_t port, device_type_t dev_type, uint8_t *buffer, verif
     while (bytes_read < total_size)
     {
         uint8_t verify_buffer[READ_CHUNK_SIZE];
+        bool replay = bytes_read < *resume_offset;
         int this_read;
 
+        if (check_cancelled())
+            return false;
+
         write_buffer[0] = CMD_READ_CHUNK;
         write_buffer[1] = ~CMD_READ_CHUNK;
 
@@ -101,10 +172,10 @@ bool pgm_read(port_handle_t port, device_type_t dev_type, uint8_t *buffer, verif
 
         this_read = (total_size - bytes_read) > READ_CHUNK_SIZE ? READ_CHUNK_SIZE : (total_size - bytes_read);
 
-        if (!serial_read(port, verify_result ? verify_buffer : (buffer + bytes_read), this_read))
+        if (!serial_read(port, (verify_result || replay) ? verify_buffer : (buffer + bytes_read), this_read))
             return false;
 
-        if (verify_result)
+        if (verify_result && !replay)
         {
             for (int i = 0; i < this_read; i++)
             {
@@ -123,8 +194,17 @@ bool pgm_read(port_handle_t port, device_type_t dev_type, uint8_t *buffer, verif
 
         bytes_read += this_read;
 
-        if (pct_callback)
-            pct_callback((bytes_read * 100) / total_size);
+        if (!replay)
+        {
+            *resume_offset = bytes_read;
+            _last_offset = bytes_read;
+
+            if (chunk_callback)
+                chunk_callback(bytes_read);
+
+            if (pct_callback)
+                pct_callback((bytes_read * 100) / total_size);
+        }
     }
 
     if (_g_last_error != PGM_ERR_COMPLETE)
@@ -139,7 +219,7 @@ bool pgm_read(port_handle_t port, device_type_t dev_type, uint8_t *buffer, verif
     return true;
 }
 
-bool pgm_blank_check(port_handle_t port, device_type_t dev_type, blank_check_result_t *blank_check_result, void (*ds_callback)(void))
+static bool blank_check_device(port_handle_t port, device_type_t dev_type, blank_check_result_t *blank_check_result, void (*ds_callback)(void))
 {
     uint8_t write_buffer[3];
     uint8_t read_buffer[3];
@@ -185,8 +265,9 @@ bool pgm_blank_check(port_handle_t port, device_type_t dev_type, blank_check_res
     return true;
 }
 
-bool pgm_write(port_handle_t port, device_type_t dev_type, uint8_t *buffer, int pass, int num_passes, bool hit_till_set,
-    uint8_t num_retries, write_result_t *write_result, void (*pct_callback)(int pct), void (*ds_callback)(void))
+static bool write_device(port_handle_t port, device_type_t dev_type, uint8_t *buffer, int pass, int num_passes, bool hit_till_set,
+    uint8_t num_retries, write_result_t *write_result,
+    void (*pct_callback)(int pct), void (*ack_callback)(int bytes_written), void (*ds_callback)(void))
 {
     uint8_t cmd_buffer[5];
     uint8_t read_buffer[5];
@@ -199,9 +280,6 @@ bool pgm_write(port_handle_t port, device_type_t dev_type, uint8_t *buffer, int
     cmd_buffer[3] = hit_till_set ? 0x01 : 0x00;
     cmd_buffer[4] = num_retries;
 
-    if (pct_callback)
-        pct_callback(0);
-
     if (!serial_write(port, cmd_buffer, 5))
         return false;
 
@@ -219,6 +297,9 @@ bool pgm_write(port_handle_t port, device_type_t dev_type, uint8_t *buffer, int
         uint8_t write_buffer[2 + WRITE_CHUNK_SIZE];
         int this_write;
 
+        if (check_cancelled())
+            return false;
+
         write_buffer[0] = CMD_WRITE_CHUNK;
         write_buffer[1] = ~CMD_WRITE_CHUNK;
 
@@ -233,6 +314,10 @@ bool pgm_write(port_handle_t port, device_type_t dev_type, uint8_t *buffer, int
             return false;
 
         bytes_written += this_write;
+        _last_offset = bytes_written;
+
+        if (ack_callback)
+            ack_callback(bytes_written);
 
         if (pct_callback)
             pct_callback((((pass * 10000) / num_passes) + (((bytes_written * 10000) / total_size) / num_passes)) / 100);
@@ -254,6 +339,79 @@ bool pgm_write(port_handle_t port, device_type_t dev_type, uint8_t *buffer, int
     return true;
 }
 
+// Recovers from a lost or corrupted response without abandoning a read or
+// blank check. Any stale input is drained and framing is re-established by
+// resetting the programmer, backing off exponentially between attempts. Errors reported by
+// the programmer itself are not recoverable and are returned as-is.
+
+static bool resync(port_handle_t port, int *attempts)
+{
+    int error = _g_last_error;
+
+    if (check_cancelled())
+        return false;
+
+    if (error != PGM_ERR_BADACK && error != PGM_ERR_TIMEOUT)
+        return false;
+
+    while (*attempts < RESYNC_MAX_ATTEMPTS)
+    {
+        Sleep(RESYNC_BACKOFF_MS << *attempts);
+        (*attempts)++;
+
+        serial_flush(port);
+
+        if (pgm_reset(port))
+            return true;
+    }
+
+    _g_last_error = error;
+    return false;
+}
+
+// Fetches the number of writes each byte took to set during the last
+// hit-till-set write. Returned in READ_CHUNK_SIZE pieces like a read. Older
+// firmware doesn't keep the map and answers PGM_ERR_INVALID_COMMAND.
+
+bool pgm_write_map(port_handle_t port, device_type_t dev_type, uint8_t *write_map)
+{
+    uint8_t write_buffer[2];
+    int total_size = pgm_get_dev_size(dev_type);
+    int bytes_read = 0;
+
+    while (bytes_read < total_size)
+    {
+        int this_read;
+
+        if (check_cancelled())
+            return false;
+
+        write_buffer[0] = CMD_WRITE_MAP;
+        write_buffer[1] = ~CMD_WRITE_MAP;
+
+        if (!serial_write(port, write_buffer, 2))
+            return false;
+
+        if (!check_return_code(port, CMD_WRITE_MAP))
+            return false;
+
+        this_read = (total_size - bytes_read) > READ_CHUNK_SIZE ? READ_CHUNK_SIZE : (total_size - bytes_read);
+
+        if (!serial_read(port, write_map + bytes_read, this_read))
+            return false;
+
+        bytes_read += this_read;
+    }
+
+    if (_g_last_error != PGM_ERR_COMPLETE)
+    {
+        _g_last_error = PGM_ERR_BADACK;
+        return false;
+    }
+
+    return true;
+}
+
 bool pgm_test(port_handle_t port, device_type_t dev_type, uint8_t test_index)
 {
     uint8_t write_buffer[4];
@@ -295,6 +453,38 @@ bool pgm_test_read(port_handle_t port, device_type_t dev_type, uint8_t *data_rea
     return true;
 }
 
+// Starts a read as the given device type and resets straight away. The
+// programmer checks the shield and its switch before touching the chip, so
+// the code left in _g_last_error says whether it would take the device.
+// Returns false only if the programmer didn't answer.
+
+bool pgm_probe(port_handle_t port, device_type_t dev_type)
+{
+    uint8_t write_buffer[3];
+    int result;
+
+    write_buffer[0] = CMD_START_READ;
+    write_buffer[1] = ~CMD_START_READ;
+    write_buffer[2] = (uint8_t)dev_type;
+
+    if (!serial_write(port, write_buffer, 3))
+        return false;
+
+    check_return_code(port, CMD_START_READ);
+
+    if (_g_last_error < 0)
+        return false;
+
+    result = _g_last_error;
+
+    if (!pgm_reset(port))
+        return false;
+
+    _g_last_error = result;
+
+    return true;
+}
+
 bool pgm_reset(port_handle_t port)
 {
     uint8_t buffer[2];
@@ -311,6 +501,15 @@ bool pgm_reset(port_handle_t port)
     return true;
 }
 
+static bool check_cancelled(void)
+{
+    if (!_g_cancel_requested)
+        return false;
+
+    _g_last_error = PGM_ERR_CANCELLED;
+    return true;
+}
+
 static bool check_return_code(port_handle_t port, uint8_t command)
 {
     uint8_t c;
@@ -340,34 +539,24 @@ static bool check_return_code(port_handle_t port, uint8_t command)
     return false;
 }
 
+// Bytes transferred by the most recent read or write pass, for reporting
+// how far an interrupted operation got
+
+int pgm_get_last_offset(void)
+{
+    return _last_offset;
+}
+
 int pgm_get_dev_size(device_type_t device_type)
 {
-    switch (device_type)
-    {
-    case C1702A:
-        return 0x100;
-    case C2704:
-        return 0x200;
-    case C2708:
-        return 0x400;
-    case TMS2716:
-        return 0x800;
-    case MCM6876X:
-        return 0x2000;
-    case D8741:
-    case D8748:
-    case P8048:
-    case P8041:
-        return 0x400;
-    case D8742:
-    case D8749:
-    case P8049:
-    case D8755:
-    case P8042:
-        return 0x800;
-    case P8050:
-        return 0x1000;
-    default:
-        return -1;
-    }
+    const device_t *device = device_get(device_type);
+
+    return device ? device->size : -1;
+}
+
+uint8_t pgm_get_erased_value(device_type_t device_type)
+{
+    const device_t *device = device_get(device_type);
+
+    return device ? device->erased_value : 0xFF;
 }
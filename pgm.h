@@ -31,7 +31,9 @@
 #define CMD_MEASURE_12V                     0x17
 #define CMD_TEST                            0x18
 #define CMD_TEST_READ                       0x19
+#define CMD_WRITE_MAP                       0x1A
 
+#define PGM_ERR_CANCELLED                   -3
 #define PGM_ERR_BADACK                      -2
 #define PGM_ERR_TIMEOUT                     -1
 #define PGM_ERR_OK                          0x00
@@ -87,13 +89,17 @@ typedef struct
 } verify_result_t;
 
 bool pgm_check_supply_voltage(port_handle_t port, float *measured_voltage);
-bool pgm_read(port_handle_t port, device_type_t dev_type, uint8_t *buffer, verify_result_t *verify_result, void(*pct_callback)(int pct), void(*ds_callback)(void));
+bool pgm_read(port_handle_t port, device_type_t dev_type, uint8_t *buffer, verify_result_t *verify_result, void(*pct_callback)(int pct), void(*chunk_callback)(int bytes_read), void(*ds_callback)(void));
 bool pgm_blank_check(port_handle_t port, device_type_t dev_type, blank_check_result_t *blank_check, void(*ds_callback)(void));
 bool pgm_write(port_handle_t port, device_type_t dev_type, uint8_t *buffer, int pass, int num_passes, bool hit_till_set,
-    uint8_t num_retries, write_result_t *write_result, void(*pct_callback)(int pct), void(*ds_callback)(void));
+    uint8_t num_retries, write_result_t *write_result, void(*pct_callback)(int pct), void(*ack_callback)(int bytes_written), void(*ds_callback)(void));
+bool pgm_write_map(port_handle_t port, device_type_t dev_type, uint8_t *write_map);
 bool pgm_reset(port_handle_t port);
+bool pgm_probe(port_handle_t port, device_type_t dev_type);
 bool pgm_test(port_handle_t port, device_type_t dev_type, uint8_t test_index);
 bool pgm_test_read(port_handle_t port, device_type_t dev_type, uint8_t *data_read);
 int pgm_get_dev_size(device_type_t device_type);
+int pgm_get_last_offset(void);
+uint8_t pgm_get_erased_value(device_type_t device_type);
 
 #endif /* __PGM_H__ */
\ No newline at end of file
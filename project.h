@@ -20,15 +20,20 @@
 #define __PROJECT_H__
 
 extern int _g_last_error;
+extern volatile sig_atomic_t _g_cancel_requested;
+
+// '-f -' reads the image from stdin or writes the dump to stdout
+#define STDIO_FILENAME "-"
 
 #ifndef _WIN32
 
 bool posix_kbhit();
 
 #define _stricmp strcasecmp
+#define _strnicmp strncasecmp
 #define _strdup strdup
 #define strcpy_s(dst, sz, src) strcpy(dst, src)
-#define Sleep sleep
+#define Sleep(ms) usleep((ms) * 1000)
 #define getch() getchar()
 #define _kbhit posix_kbhit
 
@@ -32,5 +32,6 @@ bool serial_open(const char *port_name, int baud, port_handle_t *port_handle);
 void serial_close(port_handle_t port);
 bool serial_write(port_handle_t port, uint8_t *buffer, int count);
 bool serial_read(port_handle_t port, uint8_t *buffer, int count);
+void serial_flush(port_handle_t port);
 
 #endif /* __SERIAL_H__ */
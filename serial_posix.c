@@ -132,12 +132,17 @@ bool serial_read(port_handle_t port, uint8_t *buffer, int count)
 
         nfds = select(fd + 1, &rfds, NULL, NULL, &timeout);
 
+        // Let a signal interrupt only between chunks, not mid-response
+        if (nfds == -1 && errno == EINTR)
+            continue;
+
         if (nfds == 0 || nfds == -1)
             break;
 
         rc = read(fd, buffer, count - num_bytes_read);
 
-        if (rc < 0)
+        // Zero means the device has gone away (e.g. USB unplugged)
+        if (rc <= 0)
             break;
             
         buffer += rc;
@@ -152,3 +157,8 @@ bool serial_read(port_handle_t port, uint8_t *buffer, int count)
 
     return true;
 }
+
+void serial_flush(port_handle_t port)
+{
+    tcflush((int)port, TCIOFLUSH);
+}
@@ -127,4 +127,9 @@ bool serial_read(port_handle_t port, uint8_t *buffer, int count)
     }
 
     return true;
+}
+
+void serial_flush(port_handle_t port)
+{
+    PurgeComm((HANDLE)port, PURGE_RXCLEAR | PURGE_TXCLEAR);
 }
\ No newline at end of file
@@ -0,0 +1,168 @@
+/*
+ *   File:   transform.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Address and data line scrambling
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+
+#include "transform.h"
+
+#define MAX_ADDRESS_LINES       16
+
+// Some boards wire the EPROM's address and data lines in a different order
+// to the CPU's. Each line list names, for every chip line from 0 upwards, the
+// board line it is wired to. Both permutations are turned into lookup tables
+// once, so each direction is a single table driven pass over the image.
+
+static uint8_t _data_to_chip[256];
+static uint8_t _data_from_chip[256];
+static int *_chip_address;
+static int _size;
+static bool _active;
+
+static int parse_lines(const char *list, int *lines, int max_lines);
+
+bool transform_setup(const char *address_lines, const char *data_lines, int size)
+{
+    int address_map[MAX_ADDRESS_LINES];
+    int data_map[8];
+    int address_bits = 0;
+
+    if (!address_lines && !data_lines)
+        return true;
+
+    while ((1 << address_bits) < size)
+        address_bits++;
+
+    if ((1 << address_bits) != size)
+    {
+        fprintf(stderr, "\r\nLine scrambling needs a device size which is a power of two.\r\n");
+        return false;
+    }
+
+    for (int i = 0; i < MAX_ADDRESS_LINES; i++)
+        address_map[i] = i;
+
+    for (int i = 0; i < 8; i++)
+        data_map[i] = i;
+
+    if (address_lines && parse_lines(address_lines, address_map, MAX_ADDRESS_LINES) != address_bits)
+    {
+        fprintf(stderr, "\r\nAddress lines must list each of A0-A%d once.\r\n", address_bits - 1);
+        return false;
+    }
+
+    if (data_lines && parse_lines(data_lines, data_map, 8) != 8)
+    {
+        fprintf(stderr, "\r\nData lines must list each of D0-D7 once.\r\n");
+        return false;
+    }
+
+    for (int value = 0; value < 256; value++)
+    {
+        uint8_t chip_value = 0;
+
+        for (int bit = 0; bit < 8; bit++)
+        {
+            if (value & (1 << data_map[bit]))
+                chip_value |= (1 << bit);
+        }
+
+        _data_to_chip[value] = chip_value;
+        _data_from_chip[chip_value] = (uint8_t)value;
+    }
+
+    _chip_address = malloc(size * sizeof(int));
+    _size = size;
+
+    for (int address = 0; address < size; address++)
+    {
+        int chip_address = 0;
+
+        for (int bit = 0; bit < address_bits; bit++)
+        {
+            if (address & (1 << address_map[bit]))
+                chip_address |= (1 << bit);
+        }
+
+        _chip_address[address] = chip_address;
+    }
+
+    _active = true;
+
+    return true;
+}
+
+bool transform_active(void)
+{
+    return _active;
+}
+
+void transform_to_chip(const uint8_t *board, uint8_t *chip)
+{
+    for (int address = 0; address < _size; address++)
+        chip[_chip_address[address]] = _data_to_chip[board[address]];
+}
+
+void transform_from_chip(const uint8_t *chip, uint8_t *board)
+{
+    for (int address = 0; address < _size; address++)
+        board[address] = _data_from_chip[chip[_chip_address[address]]];
+}
+
+void transform_free(void)
+{
+    if (_chip_address)
+        free(_chip_address);
+
+    _chip_address = NULL;
+    _active = false;
+}
+
+// Parses a comma separated list of line numbers, which must be a permutation
+// of 0 to count - 1. Returns count, or -1 if the list is not a permutation.
+
+static int parse_lines(const char *list, int *lines, int max_lines)
+{
+    uint32_t seen = 0;
+    int count = 0;
+    const char *pos = list;
+
+    while (*pos)
+    {
+        char *end;
+        long line = strtol(pos, &end, 10);
+
+        if (end == pos || count >= max_lines || line < 0 || line >= max_lines || (seen & (1 << line)))
+            return -1;
+
+        seen |= (1 << line);
+        lines[count++] = (int)line;
+        pos = end;
+
+        if (*pos == ',')
+            pos++;
+        else if (*pos)
+            return -1;
+    }
+
+    if (seen != (uint32_t)((1 << count) - 1))
+        return -1;
+
+    return count;
+}
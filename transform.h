@@ -0,0 +1,30 @@
+/*
+ *   File:   transform.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   Address and data line scrambling
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRANSFORM_H__
+#define __TRANSFORM_H__
+
+bool transform_setup(const char *address_lines, const char *data_lines, int size);
+bool transform_active(void);
+void transform_to_chip(const uint8_t *board, uint8_t *chip);
+void transform_from_chip(const uint8_t *chip, uint8_t *board);
+void transform_free(void);
+
+#endif /* __TRANSFORM_H__ */
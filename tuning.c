@@ -0,0 +1,140 @@
+/*
+ *   File:   tuning.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   MCM6876x rewrite tuning from chip lot history
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+
+#include "tuning.h"
+
+bool tuning_load(const char *filename, tuning_history_t *history)
+{
+    FILE *file;
+    tuning_record_t record;
+
+    memset(history, 0, sizeof(tuning_history_t));
+
+#ifdef _WIN32
+    if (fopen_s(&file, filename, "rb"))
+#else
+    if (!(file = fopen(filename, "rb")))
+#endif /* _WIN32 */
+        return false;
+
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        bool mapped = false;
+
+        if (record.magic != TUNING_MAGIC)
+            break;
+
+        history->num_chips++;
+
+        if ((int)record.max_writes > history->max_writes)
+            history->max_writes = record.max_writes;
+
+        for (int i = 0; i < 256; i++)
+        {
+            history->histogram[i] += record.histogram[i];
+            if (record.histogram[i])
+                mapped = true;
+        }
+
+        if (mapped)
+            history->num_mapped++;
+    }
+
+    fclose(file);
+
+    return true;
+}
+
+bool tuning_append(const char *filename, const tuning_record_t *record)
+{
+    FILE *file;
+    bool success;
+
+#ifdef _WIN32
+    if (fopen_s(&file, filename, "ab"))
+#else
+    if (!(file = fopen(filename, "ab")))
+#endif /* _WIN32 */
+        return false;
+
+    success = fwrite(record, sizeof(tuning_record_t), 1, file) == 1;
+
+    fclose(file);
+
+    return success;
+}
+
+void tuning_record_from_map(tuning_record_t *record, const uint8_t *write_map, int size)
+{
+    record->max_writes = 0;
+    memset(record->histogram, 0, sizeof(record->histogram));
+
+    for (int i = 0; i < size; i++)
+    {
+        record->histogram[write_map[i]]++;
+
+        if (write_map[i] > record->max_writes)
+            record->max_writes = write_map[i];
+    }
+}
+
+// The rewrite margin given to every byte is TUNING_MARGIN_FACTOR times the
+// number of writes that TUNING_PERCENTILE of the lot's bytes set within, and
+// never less than TUNING_MIN_RETRIES. On good silicon nearly every byte sets
+// first time, so the margin drops below the blind default; a lot with slow
+// cells gets more. Every byte is still written until it sets before the margin
+// is added. Until enough chips with a per-byte map have been seen the default
+// is kept.
+
+int tuning_recommend_retries(const tuning_history_t *history, int default_retries)
+{
+    uint64_t total = 0;
+    uint64_t covered = 0;
+    int writes = 0;
+    int retries;
+
+    if (history->num_mapped < TUNING_MIN_CHIPS)
+        return default_retries;
+
+    for (int i = 0; i < 256; i++)
+        total += history->histogram[i];
+
+    if (!total)
+        return default_retries;
+
+    while (writes < 255)
+    {
+        covered += history->histogram[writes];
+
+        if (covered * 1000 >= total * TUNING_PERCENTILE)
+            break;
+
+        writes++;
+    }
+
+    retries = writes * TUNING_MARGIN_FACTOR;
+
+    if (retries < TUNING_MIN_RETRIES)
+        retries = TUNING_MIN_RETRIES;
+
+    return retries > 255 ? 255 : retries;
+}
@@ -0,0 +1,54 @@
+/*
+ *   File:   tuning.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   1702A/270x/TMS2716/MCM6876x/MCS48 Programmer
+ *
+ *   MCM6876x rewrite tuning from chip lot history
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TUNING_H__
+#define __TUNING_H__
+
+#define TUNING_MAGIC            0x544C5648 /* 'HVLT' */
+#define TUNING_MIN_CHIPS        3
+#define TUNING_PERCENTILE       999     /* per mille */
+#define TUNING_MARGIN_FACTOR    2
+#define TUNING_MIN_RETRIES      2
+
+// One record is appended to the lot history for every chip written. The
+// histogram counts bytes by the number of writes it took for them to set,
+// and is empty when the programmer can't report a per-byte write map.
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t max_writes;
+    uint32_t histogram[256];
+} tuning_record_t;
+
+typedef struct
+{
+    int num_chips;
+    int num_mapped;
+    int max_writes;
+    uint32_t histogram[256];
+} tuning_history_t;
+
+bool tuning_load(const char *filename, tuning_history_t *history);
+bool tuning_append(const char *filename, const tuning_record_t *record);
+void tuning_record_from_map(tuning_record_t *record, const uint8_t *write_map, int size);
+int tuning_recommend_retries(const tuning_history_t *history, int default_retries);
+
+#endif /* __TUNING_H__ */
@@ -19,6 +19,7 @@
 
 #include "pch.h"
 
+#include "project.h"
 #include "util.h"
 
 #ifndef _WIN32
@@ -46,8 +47,47 @@ void terminal_unset_raw_mode()
     tcsetattr(STDIN_FILENO, TCSANOW, &term);
 }
 
+static void sigterm_handler(int signum)
+{
+    _g_cancel_requested = 1;
+}
+
+#else
+
+static BOOL WINAPI console_ctrl_handler(DWORD ctrl_type)
+{
+    if (ctrl_type == CTRL_C_EVENT || ctrl_type == CTRL_BREAK_EVENT || ctrl_type == CTRL_CLOSE_EVENT)
+    {
+        _g_cancel_requested = 1;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
 #endif /* _WIN32 */
 
+// Ctrl-C and SIGTERM only request cancellation. Operations stop at the next
+// chunk boundary so the programmer can be reset cleanly. A second signal
+// takes the default action, for when the programmer has stopped responding.
+
+void catch_sigterm()
+{
+#ifdef _WIN32
+    SetConsoleCtrlHandler(console_ctrl_handler, TRUE);
+#else
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sigterm_handler;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+#endif /* _WIN32 */
+}
+
 void terminal_setup(void)
 {
 #ifdef _WIN32
@@ -22,12 +22,12 @@
 #ifndef _WIN32
 
 bool posix_kbhit();
-void catch_sigterm();
 void terminal_set_raw_mode();
 void terminal_unset_raw_mode();
 
 #endif /* _WIN32 */
 
+void catch_sigterm();
 void terminal_setup(void);
 
 #endif /* __UTIL_H__ */
\ No newline at end of file